@@ -0,0 +1,53 @@
+# Shared by the benchmark scripts, which source it with the Lua sources as
+# the first argument. It copies those into a scratch directory, builds a
+# stock interpreter there and sets up the helpers below.
+
+if [ $# -lt 1 ] || [ ! -f "$1/src/lua.c" ]; then
+	echo "usage: $0 LUA_SRC [$USAGE]" >&2
+	exit 2
+fi
+
+BENCH=$(cd "$(dirname "$0")" && pwd)
+LUA_SRC=$(cd "$1" && pwd)
+LEAN=${LEAN:-$BENCH/../target/release/lean}
+LEAN_FLAGS=${LEAN_FLAGS:-}
+WORK=$(mktemp -d)
+
+trap 'rm -rf "$WORK"' EXIT
+shift
+
+PERF=
+TIME=
+
+if command -v perf >/dev/null 2>&1 && perf stat -e instructions true >/dev/null 2>&1; then
+	PERF=perf
+fi
+
+if [ -x /usr/bin/time ] && /usr/bin/time -f %M true >/dev/null 2>&1; then
+	TIME=/usr/bin/time
+fi
+
+# builds the interpreter of a copy of the sources, quietly
+build() {
+	make -C "$1/src" linux >"$WORK/build.log" 2>&1 || {
+		cat "$WORK/build.log" >&2
+		exit 1
+	}
+}
+
+# compiles a Lua file and transpiles it into the binary `$WORK/NAME`
+build_lean() {
+	"$WORK/stock/src/luac" -o "$WORK/$1.luac" "$2"
+	"$LEAN" $LEAN_FLAGS -t "$WORK/$1.luac" >"$WORK/lean/src/lua.c"
+	build "$WORK/lean"
+	cp "$WORK/lean/src/lua" "$WORK/$1"
+}
+
+# the nanoseconds since the epoch
+now() {
+	date +%s%N
+}
+
+cp -R "$LUA_SRC" "$WORK/stock"
+cp -R "$LUA_SRC" "$WORK/lean"
+build "$WORK/stock"
@@ -0,0 +1,44 @@
+-- allocation heavy tree building, dominated by table creation and the GC
+local max_depth = tonumber(...) or 16
+local min_depth = 4
+
+local function bottom_up(depth)
+	if depth == 0 then
+		return {}
+	end
+
+	depth = depth - 1
+
+	return { bottom_up(depth), bottom_up(depth) }
+end
+
+local function check(tree)
+	if tree[1] then
+		return 1 + check(tree[1]) + check(tree[2])
+	end
+
+	return 1
+end
+
+if min_depth + 2 > max_depth then
+	max_depth = min_depth + 2
+end
+
+local stretch = max_depth + 1
+
+print("stretch", stretch, check(bottom_up(stretch)))
+
+local long_lived = bottom_up(max_depth)
+
+for depth = min_depth, max_depth, 2 do
+	local iterations = 2 ^ (max_depth - depth + min_depth)
+	local sum = 0
+
+	for _ = 1, iterations do
+		sum = sum + check(bottom_up(depth))
+	end
+
+	print(math.tointeger(iterations), depth, sum)
+end
+
+print("long lived", max_depth, check(long_lived))
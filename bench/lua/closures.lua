@@ -0,0 +1,68 @@
+-- callbacks and upvalues, dominated by closure creation and indirect calls
+local n = tonumber(...) or 300000
+
+local function map(list, f)
+	local out = {}
+
+	for i = 1, #list do
+		out[i] = f(list[i])
+	end
+
+	return out
+end
+
+local function filter(list, f)
+	local out = {}
+
+	for i = 1, #list do
+		if f(list[i]) then
+			out[#out + 1] = list[i]
+		end
+	end
+
+	return out
+end
+
+local function reduce(list, f, acc)
+	for i = 1, #list do
+		acc = f(acc, list[i])
+	end
+
+	return acc
+end
+
+local function counter()
+	local count = 0
+
+	return function(by)
+		count = count + by
+
+		return count
+	end
+end
+
+local list = {}
+
+for i = 1, 100 do
+	list[i] = i
+end
+
+local total = 0
+local tick = counter()
+
+for i = 1, n // 100 do
+	local k = i % 5
+	local mapped = map(list, function(v)
+		return v * k
+	end)
+	local kept = filter(mapped, function(v)
+		return v % 3 == 0
+	end)
+
+	total = total + reduce(kept, function(a, b)
+		return a + b
+	end, 0)
+	tick(1)
+end
+
+print(total, tick(0))
@@ -0,0 +1,12 @@
+-- naive recursion, dominated by calls and integer arithmetic
+local n = tonumber(...) or 32
+
+local function fib(n)
+	if n < 2 then
+		return n
+	end
+
+	return fib(n - 1) + fib(n - 2)
+end
+
+print(fib(n))
@@ -0,0 +1,51 @@
+-- table heavy objects with metatables and method calls
+local n = tonumber(...) or 2000000
+
+local Vector = {}
+Vector.__index = Vector
+
+function Vector.new(x, y)
+	return setmetatable({ x = x, y = y }, Vector)
+end
+
+function Vector:add(other)
+	return Vector.new(self.x + other.x, self.y + other.y)
+end
+
+function Vector:scale(k)
+	self.x = self.x * k
+	self.y = self.y * k
+
+	return self
+end
+
+function Vector:length2()
+	return self.x * self.x + self.y * self.y
+end
+
+local Particle = setmetatable({}, { __index = Vector })
+Particle.__index = Particle
+
+function Particle.new(x, y, mass)
+	local self = setmetatable(Vector.new(x, y), Particle)
+
+	self.mass = mass
+
+	return self
+end
+
+function Particle:energy()
+	return 0.5 * self.mass * self:length2()
+end
+
+local total = 0
+local acc = Vector.new(0, 0)
+
+for i = 1, n do
+	local p = Particle.new(i % 7, i % 11, 1 + i % 3)
+
+	acc = acc:add(p):scale(0.5)
+	total = total + p:energy()
+end
+
+print(string.format("%0.3f %0.3f %0.3f", total, acc.x, acc.y))
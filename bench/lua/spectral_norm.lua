@@ -0,0 +1,59 @@
+-- numeric loops over arrays with calls in the innermost loop
+local n = tonumber(...) or 500
+
+local function a(i, j)
+	local ij = i + j - 1
+
+	return 1.0 / (ij * (ij - 1) * 0.5 + i)
+end
+
+local function av(x, y, n)
+	for i = 1, n do
+		local sum = 0
+
+		for j = 1, n do
+			sum = sum + a(i, j) * x[j]
+		end
+
+		y[i] = sum
+	end
+end
+
+local function atv(x, y, n)
+	for i = 1, n do
+		local sum = 0
+
+		for j = 1, n do
+			sum = sum + a(j, i) * x[j]
+		end
+
+		y[i] = sum
+	end
+end
+
+local function atav(x, y, t, n)
+	av(x, t, n)
+	atv(t, y, n)
+end
+
+local u, v, t = {}, {}, {}
+
+for i = 1, n do
+	u[i] = 1
+end
+
+for _ = 1, 10 do
+	atav(u, v, t, n)
+	atav(v, u, t, n)
+end
+
+local vbv, vv = 0, 0
+
+for i = 1, n do
+	local ui, vi = u[i], v[i]
+
+	vbv = vbv + ui * vi
+	vv = vv + vi * vi
+end
+
+print(string.format("%0.9f", math.sqrt(vbv / vv)))
@@ -0,0 +1,25 @@
+-- string concatenation, formatting and buffers built with table.concat
+local n = tonumber(...) or 200000
+
+local buf = {}
+
+for i = 1, n do
+	buf[#buf + 1] = "item " .. i .. ": " .. string.format("%08x", i * 2654435761 % 4294967296)
+end
+
+local joined = table.concat(buf, "\n")
+local count = 0
+
+for line in joined:gmatch("[^\n]+") do
+	if line:sub(-1) == "0" then
+		count = count + 1
+	end
+end
+
+local s = ""
+
+for i = 1, n // 100 do
+	s = s .. string.char(65 + i % 26)
+end
+
+print(#joined, count, #s, s:sub(1, 26))
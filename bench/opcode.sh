@@ -0,0 +1,106 @@
+#!/bin/sh
+# Times the templates of single opcodes, each in a loop over operands of one
+# type, as listed in `bench/opcode.txt`. One CSV row is printed per case:
+#
+#   opcode,type,ns_op,cycles_op[,base_ns_op,change_pct]
+#
+# The cycles need `perf` and are left empty without it. Given the output of
+# an earlier run, every case is compared against it as well, and the script
+# fails when any got slower by more than the threshold.
+#
+# usage: bench/opcode.sh LUA_SRC [baseline.csv]
+#
+#   LUA_SRC       an unpacked Lua 5.4.3 release
+#   LEAN          the lean binary, defaults to `target/release/lean`
+#   LEAN_FLAGS    extra options for lean, such as `--static-proto`
+#   COUNT         iterations of each loop, defaults to 2000000
+#   THRESHOLD     the slowdown in percent that fails, defaults to 10
+
+set -eu
+
+USAGE="baseline.csv"
+COUNT=${COUNT:-2000000}
+THRESHOLD=${THRESHOLD:-10}
+UNROLL=8
+
+. "$(dirname "$0")/common.sh"
+
+BASELINE=${1:-}
+
+# writes a loop running the body of a case, which prints its locals
+# at the end so none of them can be left unused
+write_case() {
+	echo "local n = tonumber(...)"
+	echo "local a, b, c = 0, 5, 3"
+	echo "local x, y = 0.5, 2.5"
+	echo "local s = \"12345678\""
+	echo "$1"
+	echo "for i = 1, n do"
+
+	i=0
+
+	while [ "$i" -lt "$UNROLL" ]; do
+		echo "$2"
+		i=$((i + 1))
+	done
+
+	echo "end"
+	echo "print(a, b, c, x, y, s)"
+}
+
+# runs a case and sets `ns` and `cycles` to what it took
+time_case() {
+	if [ -n "$PERF" ]; then
+		set -- $PERF stat -x, -e cycles -o "$WORK/perf.txt" -- "$@"
+	fi
+
+	start=$(now)
+	"$@" >/dev/null
+	end=$(now)
+
+	ns=$((end - start))
+	cycles=
+
+	if [ -n "$PERF" ]; then
+		cycles=$(grep cycles "$WORK/perf.txt" | cut -d, -f1)
+	fi
+}
+
+# the cost of one run of the body beyond that of the loop
+per_op() {
+	echo "$1 $2" | awk -v n="$((COUNT * UNROLL))" 'NF == 2 { printf "%.3f", ($2 - $1) / n }'
+}
+
+echo "opcode,type,ns_op,cycles_op${BASELINE:+,base_ns_op,change_pct}"
+
+grep -v '^#' "$BENCH/opcode.txt" | while IFS='@' read -r opcode type setup body; do
+	write_case "$setup" "$body" >"$WORK/case.lua"
+	build_lean case "$WORK/case.lua"
+	time_case "$WORK/case" "$COUNT"
+
+	if [ "$opcode" = empty ]; then
+		empty_ns=$ns
+		empty_cycles=$cycles
+		continue
+	fi
+
+	ns_op=$(per_op "$empty_ns" "$ns")
+	row="$opcode,$type,$ns_op,$(per_op "$empty_cycles" "$cycles")"
+
+	if [ -n "$BASELINE" ]; then
+		base=$(grep "^$opcode,$type," "$BASELINE" | cut -d, -f3 || true)
+		change=$(echo "$ns_op $base" | awk '$2 > 0 { printf "%.1f", ($1 / $2 - 1) * 100 }')
+		row="$row,$base,$change"
+
+		if [ -n "$change" ] && awk -v v="$change" -v t="$THRESHOLD" 'BEGIN { exit !(v > t) }'; then
+			echo "$opcode on $type is $change% slower than the baseline" >&2
+			touch "$WORK/failed"
+		fi
+	fi
+
+	echo "$row"
+done
+
+if [ -f "$WORK/failed" ]; then
+	exit 1
+fi
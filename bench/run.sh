@@ -0,0 +1,95 @@
+#!/bin/sh
+# Runs every workload in `bench/lua` under a stock Lua and as a transpiled
+# binary, printing one CSV row per run to stdout:
+#
+#   workload,runner,run,wall_s,instructions,max_rss_kb
+#
+# Instructions need `perf` and the peak RSS needs GNU `time`; the fields are
+# left empty when those are missing. Nothing is downloaded, both binaries are
+# built from the Lua 5.4 sources given, and a workload whose output differs
+# between the two makes the script fail once every row is written.
+#
+# usage: bench/run.sh LUA_SRC [workload ...]
+#
+#   LUA_SRC       an unpacked Lua 5.4.3 release
+#   LEAN          the lean binary, defaults to `target/release/lean`
+#   LEAN_FLAGS    extra options for lean, such as `--static-proto`
+#   RUNS          times each workload is run, defaults to 3
+#   ARG_<name>    the size argument of a workload, such as `ARG_fib=35`
+
+set -eu
+
+USAGE="workload ..."
+RUNS=${RUNS:-3}
+
+. "$(dirname "$0")/common.sh"
+
+if [ $# -eq 0 ]; then
+	set -- $(cd "$BENCH/lua" && ls *.lua | sed 's/\.lua$//')
+fi
+
+# runs a command, writing its output to `$WORK/out.txt`
+# and a row of what it took to stdout
+measure() {
+	name=$1
+	runner=$2
+	run=$3
+	shift 3
+
+	if [ -n "$PERF" ]; then
+		set -- $PERF stat -x, -e instructions -o "$WORK/perf.txt" -- "$@"
+	fi
+
+	if [ -n "$TIME" ]; then
+		set -- $TIME -f %M -o "$WORK/rss.txt" "$@"
+	fi
+
+	start=$(now)
+	"$@" >"$WORK/out.txt"
+	end=$(now)
+
+	inst=
+	rss=
+
+	if [ -n "$PERF" ]; then
+		inst=$(grep instructions "$WORK/perf.txt" | cut -d, -f1)
+	fi
+
+	if [ -n "$TIME" ]; then
+		rss=$(tail -n 1 "$WORK/rss.txt")
+	fi
+
+	wall=$(echo "$start $end" | awk '{ printf "%.6f", ($2 - $1) / 1e9 }')
+
+	echo "$name,$runner,$run,$wall,$inst,$rss"
+}
+
+echo "workload,runner,run,wall_s,instructions,max_rss_kb"
+
+failed=
+
+for name in "$@"; do
+	source=$BENCH/lua/$name.lua
+	arg=$(eval "echo \${ARG_$name:-}")
+
+	build_lean "$name" "$source"
+
+	run=1
+
+	while [ "$run" -le "$RUNS" ]; do
+		measure "$name" lua "$run" "$WORK/stock/src/lua" "$source" $arg
+		mv "$WORK/out.txt" "$WORK/expect.txt"
+		measure "$name" lean "$run" "$WORK/$name" $arg
+
+		if ! cmp -s "$WORK/out.txt" "$WORK/expect.txt"; then
+			echo "$name: lean output differs from lua" >&2
+			failed=1
+		fi
+
+		run=$((run + 1))
+	done
+done
+
+if [ -n "$failed" ]; then
+	exit 1
+fi
@@ -1,3 +1,5 @@
+pub const LUA_HEADER_BOILERPLATE: &str = include_str!("./template/helper.h");
+
 pub const LUA_INTERP_BOILERPLATE: &str = include_str!("./template/helper.c");
 
 pub const LUA_MACRO_BOILERPLATE: &str = include_str!("./template/macro.c");
@@ -6,8 +8,8 @@ pub const LUA_SETUP_BOILERPLATE: &str = include_str!("./template/setup.c");
 
 pub const LUA_INIT_CODE: &str = "
 CallInfo *const ci = L->ci;
-LClosure *const cl = lua_get_l_closure(ci);
-TValue const *const rt_k = cl->p->k;
+CClosure *const cl = clCvalue(s2v(ci->func));
+TValue *const rt_k = lua_get_proto(cl)->k;
 
 checkstackGCp(L, `NUM_STACK`, ci->func);
 
@@ -23,4 +25,10 @@ while (L->top < param_end) {
 }
 ";
 
-pub const LUA_NUM_VARARG: &str = "int const n_vararg = cast_int(L->top - base) - `NUM_PARAM`;";
+pub const LUA_NUM_VARARG: &str = "
+int const n_vararg = status == LUA_YIELD
+	? cast_int(ctx / `NUM_RESUME`) - `NUM_PARAM`
+	: cast_int(L->top - base) - `NUM_PARAM`;
+";
+
+pub const LUA_VARARG_CTX: &str = "`ID` + (n_vararg + `NUM_PARAM`) * `NUM_RESUME`";
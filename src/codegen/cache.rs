@@ -0,0 +1,130 @@
+use crate::common::types::{Proto, Value};
+use std::{
+	fs,
+	hash::Hasher,
+	io::Result,
+	path::{Path, PathBuf},
+};
+
+// changed whenever the same function is written differently, so entries
+// left by an older `lean` are never found
+pub const CACHE_VERSION: u64 = 2;
+
+const FNV_BASIS: u128 = 0x6c62_272e_07bb_0142_62b8_2175_6295_c58d;
+const FNV_PRIME: u128 = 0x0000_0000_0100_0000_0000_0000_0000_013b;
+
+// FNV-1a over 128 bits, which unlike the hasher of the standard library
+// gives the same hash on every run
+pub struct Digest {
+	state: u128,
+}
+
+impl Digest {
+	pub fn new() -> Self {
+		Self { state: FNV_BASIS }
+	}
+
+	pub fn finish_wide(&self) -> u128 {
+		self.state
+	}
+}
+
+impl Hasher for Digest {
+	fn write(&mut self, data: &[u8]) {
+		for &v in data {
+			self.state ^= u128::from(v);
+			self.state = self.state.wrapping_mul(FNV_PRIME);
+		}
+	}
+
+	fn finish(&self) -> u64 {
+		self.state as u64
+	}
+}
+
+// the hash of everything a function is made of, where its children are
+// only counted by their own hashes as they are found in `child_list`
+pub fn hash_proto(proto: &Proto, child_list: &[u128]) -> u128 {
+	let mut h = Digest::new();
+
+	h.write(&[proto.is_vararg, proto.num_stack, proto.num_param]);
+	h.write_u32(proto.line_defined);
+
+	let len = proto.block_list.iter().map(|v| v.code.len()).sum();
+
+	h.write_usize(len);
+
+	for inst in proto.block_list.iter().flat_map(|v| &v.code) {
+		h.write_u32(inst.inner);
+	}
+
+	h.write_usize(proto.value_list.len());
+
+	for value in &proto.value_list {
+		match value {
+			Value::Nil => h.write_u8(0),
+			Value::False => h.write_u8(1),
+			Value::True => h.write_u8(2),
+			Value::Integer(v) => {
+				h.write_u8(3);
+				h.write_i64(*v);
+			}
+			Value::Number(v) => {
+				h.write_u8(4);
+				h.write_u64(v.to_bits());
+			}
+			Value::NoString => h.write_u8(5),
+			Value::String(v) => {
+				h.write_u8(6);
+				h.write_usize(v.len());
+				h.write(v);
+			}
+		}
+	}
+
+	h.write_usize(proto.upval_list.len());
+
+	for upval in &proto.upval_list {
+		h.write(&[upval.in_stack as u8, upval.index]);
+	}
+
+	h.write_usize(child_list.len());
+
+	for &child in child_list {
+		h.write_u128(child);
+	}
+
+	h.finish_wide()
+}
+
+// the C written for single functions, kept on disk under the hash of
+// everything it was written from so unchanged functions are only read back
+pub struct Cache {
+	dir: PathBuf,
+}
+
+impl Cache {
+	pub fn new(dir: &Path) -> Result<Self> {
+		fs::create_dir_all(dir)?;
+
+		Ok(Self { dir: dir.into() })
+	}
+
+	fn path_of(&self, key: u128) -> PathBuf {
+		self.dir.join(format!("{:032x}.c", key))
+	}
+
+	pub fn load(&self, key: u128) -> Option<Vec<u8>> {
+		fs::read(self.path_of(key)).ok()
+	}
+
+	// entries are written under a name of their own and then moved in
+	// place, so other runs sharing the cache never read half of one
+	pub fn store(&self, key: u128, data: &[u8]) -> Result<()> {
+		let path = self.path_of(key);
+		let temp = path.with_extension(format!("{}.tmp", std::process::id()));
+
+		fs::write(&temp, data)?;
+		fs::rename(temp, path)
+	}
+}
@@ -0,0 +1,75 @@
+use crate::{
+	codegen::infer::Inference,
+	common::types::{Opcode, Proto},
+};
+use std::collections::HashMap;
+
+// how a `Concat` in a chain is written, where a chain is a run of them in
+// one block that each take the result of the one before as their first
+// operand, with nothing else reading it in between
+#[derive(Clone, Copy)]
+pub enum Chain {
+	Start,
+	Part,
+	End,
+}
+
+// instructions that can sit between two links of a chain, which may raise
+// errors but can neither yield nor build a chain of their own
+fn is_between(op: Opcode) -> bool {
+	!matches!(
+		op,
+		Opcode::Concat
+			| Opcode::Close
+			| Opcode::Tbc
+			| Opcode::Call
+			| Opcode::TailCall
+			| Opcode::TForCall
+			| Opcode::Return
+			| Opcode::Return0
+			| Opcode::Return1
+	)
+}
+
+// finds the chains of every block, by the instruction index of each link
+pub fn find_chains(proto: &Proto, infer: &Inference) -> HashMap<usize, Chain> {
+	let mut chain_map = HashMap::new();
+	let mut start = 0;
+
+	for blk in &proto.block_list {
+		let mut last: Option<usize> = None;
+
+		for (i, inst) in blk.code.iter().enumerate() {
+			let pc = start + i;
+
+			if inst.opcode() != Opcode::Concat {
+				continue;
+			}
+
+			let reg = inst.a() as usize;
+			let linked = last.filter(|&prev| {
+				blk.code[prev - start].a() == inst.a()
+					&& (prev + 1..pc).all(|v| {
+						is_between(blk.code[v - start].opcode())
+							&& infer.use_range(v, reg).is_none()
+							&& infer.def_range(v, reg).is_none()
+					})
+			});
+
+			if let Some(prev) = linked {
+				match chain_map.get(&prev) {
+					Some(Chain::End) => chain_map.insert(prev, Chain::Part),
+					_ => chain_map.insert(prev, Chain::Start),
+				};
+
+				chain_map.insert(pc, Chain::End);
+			}
+
+			last = Some(pc);
+		}
+
+		start += blk.code.len();
+	}
+
+	chain_map
+}
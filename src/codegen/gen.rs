@@ -1,12 +1,30 @@
 use crate::{
 	codegen::baked::{
-		LUA_INIT_CODE, LUA_INTERP_BOILERPLATE, LUA_MACRO_BOILERPLATE, LUA_NUM_PARAM,
-		LUA_NUM_VARARG, LUA_SETUP_BOILERPLATE,
+		LUA_HEADER_BOILERPLATE, LUA_INIT_CODE, LUA_INTERP_BOILERPLATE, LUA_MACRO_BOILERPLATE,
+		LUA_NUM_PARAM, LUA_NUM_VARARG, LUA_SETUP_BOILERPLATE, LUA_VARARG_CTX,
 	},
-	common::types::{Inst, Opcode, Proto, Target, Value},
+	codegen::{
+		cache::{hash_proto, Cache, Digest, CACHE_VERSION},
+		concat::{find_chains, Chain},
+		inline::{constant_closure_list, find_binding, is_inlinable, Binding},
+		intrinsic::{find_intrinsic, helper_list, is_vararg_select},
+		profile::{is_cold, Profile},
+		tail::{can_loop, find_self_ref, is_self_call, SelfRef},
+		unboxed::{literal, Unboxed},
+	},
+	common::types::{Inst, Local, Opcode, Proto, Target, Value},
 	dumper::dump_lua_module,
+	loader::load_debug_info,
+	splitter::{dominator_list, loop_depth_list, reverse_postorder},
+};
+use std::{
+	collections::HashMap,
+	hash::Hash,
+	io::{Result, Write},
+	path::Path,
+	sync::atomic::{AtomicUsize, Ordering},
+	thread,
 };
-use std::io::{Result, Write};
 
 enum OpType {
 	Normal,
@@ -14,6 +32,7 @@ enum OpType {
 	Extra,
 	Control,
 	Closure,
+	Yield,
 }
 
 const fn as_op_type(op: Opcode) -> OpType {
@@ -46,12 +65,9 @@ const fn as_op_type(op: Opcode) -> OpType {
 		| Opcode::Concat
 		| Opcode::Close
 		| Opcode::Tbc
-		| Opcode::Call
-		| Opcode::TailCall
 		| Opcode::Return
 		| Opcode::Return0
 		| Opcode::Return1
-		| Opcode::TForCall
 		| Opcode::Vararg
 		| Opcode::VarargPrep
 		| Opcode::ExtraArg
@@ -100,6 +116,7 @@ const fn as_op_type(op: Opcode) -> OpType {
 		| Opcode::TForPrep
 		| Opcode::TForLoop => OpType::Control,
 		Opcode::Closure => OpType::Closure,
+		Opcode::Call | Opcode::TailCall | Opcode::TForCall => OpType::Yield,
 	}
 }
 
@@ -116,48 +133,67 @@ fn write_instruction(w: &mut dyn Write, inst: Inst, call: &str) -> Result<()> {
 	write!(w, "{:?}({:#010x}{});", inst.opcode(), inst.inner, call)
 }
 
-fn write_const_list(w: &mut dyn Write, proto: &Proto) -> Result<()> {
-	let len = proto.value_list.len();
-
-	write!(w, "static TValue const ct_k[{}] = {{", len)?;
-
-	for v in &proto.value_list {
-		match v {
-			Value::Nil | Value::NoString | Value::String(_) => {
-				write!(w, "{{ {{ .i = 0 }}, LUA_VNIL }}")
-			}
-			Value::False => {
-				write!(w, "{{ {{ .i = 0 }}, LUA_VFALSE }}")
-			}
-			Value::True => {
-				write!(w, "{{ {{ .i = 0 }}, LUA_VTRUE }}")
-			}
-			Value::Integer(i) => {
-				write!(w, "{{ {{ .i = {} }}, LUA_VNUMINT }}", i)
-			}
-			Value::Number(n) => {
-				let mut ns = n.to_string();
+// instructions run rarely enough that they are worth a call to their
+// shared helper whenever code size matters
+fn is_outlined(op: Opcode) -> bool {
+	matches!(
+		op,
+		Opcode::Close
+			| Opcode::Tbc
+			| Opcode::Len
+			| Opcode::Concat
+			| Opcode::SetList
+			| Opcode::Vararg
+	)
+}
 
-				// nasty but eh
-				if !ns.contains('.') {
-					ns += ".0";
-				}
+fn write_outline(w: &mut dyn Write, inst: Inst, call: &str) -> Result<()> {
+	match inst.opcode() {
+		Opcode::Vararg => write!(
+			w,
+			"op_outline(Vararg, {:#010x}, n_vararg);lua_update_base(ci);",
+			inst.inner
+		),
+		op => write!(w, "op_outline({:?}, {:#010x}{});", op, inst.inner, call),
+	}
+}
 
-				write!(w, "{{ {{ .n = {} }}, LUA_VNUMFLT }}", ns)
-			}
-		}?;
+// the links of a chain of `Concat` ops build up one string in `concat_part`
+fn write_chain(w: &mut dyn Write, inst: Inst, chain: Chain) -> Result<()> {
+	match chain {
+		Chain::Start => write!(w, "op_concat_part({:#010x}, 1);", inst.inner),
+		Chain::Part => write!(w, "op_concat_part({:#010x}, 0);", inst.inner),
+		Chain::End => write!(w, "op_concat_end({:#010x});", inst.inner),
+	}
+}
 
-		write!(w, ",")?;
+// the file a chunk was loaded from, as chunks loaded from a string
+// have their code as the source and no file to point the lines at
+fn line_file(source: &[u8]) -> Option<&[u8]> {
+	match source.split_first() {
+		Some((b'@' | b'=', file)) => Some(file),
+		_ => None,
 	}
+}
 
-	write!(w, "}};")
+// makes the C compiler and debuggers report the Lua line for
+// the code after it, up to the next newline
+fn write_line(w: &mut dyn Write, line: u32, file: &[u8]) -> Result<()> {
+	write!(w, "\n#line {} ", line)?;
+	write_c_string(w, file)?;
+	writeln!(w)
 }
 
-fn write_init(w: &mut dyn Write, proto: &Proto) -> Result<()> {
+fn write_init(
+	w: &mut dyn Write,
+	proto: &Proto,
+	unboxed: &Unboxed,
+	num_resume: usize,
+) -> Result<()> {
 	let num_stack = proto.num_stack.to_string();
 
 	write!(w, "{}", LUA_INIT_CODE.replace("`NUM_STACK`", &num_stack))?;
-	write_const_list(w, proto)?;
+	unboxed.write_local_list(w)?;
 
 	if proto.num_param != 0 {
 		let num = proto.num_param.to_string();
@@ -169,33 +205,359 @@ fn write_init(w: &mut dyn Write, proto: &Proto) -> Result<()> {
 		write!(w, "int const n_vararg = 0;")?;
 	} else {
 		let num = proto.num_param.to_string();
+		let code = LUA_NUM_VARARG
+			.replace("`NUM_PARAM`", &num)
+			.replace("`NUM_RESUME`", &num_resume.to_string());
 
-		write!(w, "{}", LUA_NUM_VARARG.replace("`NUM_PARAM`", &num))?;
+		write!(w, "{}", code)?;
 	}
 
 	Ok(())
 }
 
-fn write_function(w: &mut dyn Write, index: &mut usize, proto: &Proto) -> Result<()> {
+// the context a call that may yield resumes with, which also has to
+// carry the vararg count as it is not kept anywhere else
+fn resume_ctx(proto: &Proto, id: usize, num_resume: usize) -> String {
+	if proto.is_vararg == 0 {
+		id.to_string()
+	} else {
+		LUA_VARARG_CTX
+			.replace("`ID`", &id.to_string())
+			.replace("`NUM_PARAM`", &proto.num_param.to_string())
+			.replace("`NUM_RESUME`", &num_resume.to_string())
+	}
+}
+
+// jumps back to the call a resumed function yielded in, after reloading
+// the locals that were spilled to the stack for it
+fn write_resume_list(w: &mut dyn Write, resume_list: &[String], num_resume: usize) -> Result<()> {
+	if resume_list.is_empty() {
+		return Ok(());
+	}
+
+	writeln!(w, "if (status == LUA_YIELD) {{")?;
+	writeln!(w, "switch (ctx % {}) {{", num_resume)?;
+
+	for (i, reload) in resume_list.iter().enumerate() {
+		writeln!(w, "case {}: {}goto resume_{};", i + 1, reload, i + 1)?;
+	}
+
+	writeln!(w, "}}")?;
+	writeln!(w, "}}")
+}
+
+// strings up to this length are interned by Lua
+const LUAI_MAXSHORTLEN: usize = 40;
+
+// the most upvalues a closure can hold, one of which the C closure of a
+// transpiled function spends on its prototype
+const MAXUPVAL: usize = 255;
+
+// a function to be written, along with where its children are in the list
+// and the name its C functions are given
+struct Function<'a> {
+	index: usize,
+	hash: u128,
+	id: String,
+	proto: &'a Proto<'a>,
+	child_ref: Vec<usize>,
+	source: Option<&'a [u8]>,
+	is_counted: bool,
+	count_list: Option<Vec<u64>>,
+	name: Option<&'a [u8]>,
+	line_list: Option<Vec<u32>>,
+	self_ref: SelfRef<'a>,
+	inline_map: HashMap<Binding, usize>,
+	outline_list: Vec<bool>,
+}
+
+// how the output trades its size for its speed
+#[derive(Clone, Copy, PartialEq, Eq)]
+pub enum OptLevel {
+	// rarely run opcodes and metamethod fallbacks always call shared
+	// helpers, and no function is copied into its callers
+	Size,
+	// as with `Size` but only outside of loops, or in blocks a profile
+	// found cold, so loops keep their speed
+	Balanced,
+	// every instruction is expanded in place
+	Speed,
+}
+
+// how the C output is produced
+pub struct Settings {
+	pub num_worker: usize,
+	pub num_shard: usize,
+	pub static_proto: bool,
+	pub profile: bool,
+	pub feedback: Option<Profile>,
+	pub debug: bool,
+	pub opt_level: OptLevel,
+	pub cache: Option<Cache>,
+}
+
+// a module bundled along with the entry, found through `require`
+pub struct Module<'a> {
+	pub name: &'a str,
+	pub proto: Proto<'a>,
+}
+
+// numbers the entry and then every module after it, so the functions
+// of each module take up their own range of `lua_func_N`
+fn list_bundle<'a>(
+	list: &mut Vec<Function<'a>>,
+	proto: &'a Proto,
+	module_list: &'a [Module],
+) -> Vec<usize> {
+	let mut index = 0;
+	let mut root_list = Vec::with_capacity(module_list.len());
+
+	list_function(list, &mut index, proto, None, SelfRef::default());
+
+	for module in module_list {
+		index += 1;
+		root_list.push(index);
+		list_function(list, &mut index, &module.proto, None, SelfRef::default());
+	}
+
+	set_id_list(list);
+
+	root_list
+}
+
+// names every function after the hash of what it is made of, so it keeps
+// its name wherever it moves to in the program; the rare functions with
+// the same hash are told apart by the order they come in
+fn set_id_list(list: &mut [Function]) {
+	let mut seen: HashMap<u64, usize> = HashMap::new();
+
+	for func in list {
+		let hash = (func.hash >> 64) as u64;
+		let count = seen.entry(hash).or_default();
+
+		func.id = match *count {
+			0 => format!("{:016x}", hash),
+			n => format!("{:016x}_{}", hash, n),
+		};
+
+		*count += 1;
+	}
+}
+
+// numbers the functions depth first, listing each one after its children
+// stripped children share the source of their parent
+fn list_function<'a>(
+	list: &mut Vec<Function<'a>>,
+	index: &mut usize,
+	proto: &'a Proto,
+	parent: Option<&'a [u8]>,
+	self_ref: SelfRef<'a>,
+) {
 	let mut child_ref = Vec::with_capacity(proto.child_list.len());
+	let mut child_hash = Vec::with_capacity(proto.child_list.len());
 	let saved = *index;
+	let source = proto.source.or(parent);
 
-	for child in &proto.child_list {
+	if proto.upval_list.len() >= MAXUPVAL {
+		panic!("functions with {} upvalues are not supported", MAXUPVAL);
+	}
+
+	for (i, child) in proto.child_list.iter().enumerate() {
 		*index += 1;
-		child_ref.push(*index);
-		write_function(w, index, child)?;
+		list_function(list, index, child, source, find_self_ref(proto, i));
+		child_ref.push(list.len() - 1);
+		child_hash.push(list.last().unwrap().hash);
+	}
+
+	list.push(Function {
+		index: saved,
+		hash: hash_proto(proto, &child_hash),
+		id: String::new(),
+		proto,
+		child_ref,
+		source,
+		is_counted: false,
+		count_list: None,
+		name: None,
+		line_list: None,
+		self_ref,
+		inline_map: HashMap::new(),
+		outline_list: Vec::new(),
+	});
+}
+
+// lets functions copy the small ones they can only reach through a
+// binding that never changes into the place of their calls to them
+fn set_inline_list(list: &mut [Function], settings: &Settings) {
+	if settings.opt_level == OptLevel::Size {
+		return;
+	}
+
+	let mut found = Vec::new();
+
+	for (i, func) in list.iter().enumerate() {
+		for (reg, child) in constant_closure_list(func.proto) {
+			let callee = func.child_ref[child];
+
+			if !is_inlinable(list[callee].proto) {
+				continue;
+			}
+
+			found.push((i, Binding::Local(reg), callee));
+
+			for (j, sibling) in func.proto.child_list.iter().enumerate() {
+				let target = func.child_ref[j];
+
+				for (upval, v) in sibling.upval_list.iter().enumerate() {
+					if v.in_stack && u32::from(v.index) == reg && target != callee {
+						found.push((target, Binding::Upval(upval as u32), callee));
+					}
+				}
+			}
+		}
 	}
 
-	write!(w, "int lua_func_{}(lua_State* L) {{", saved)?;
-	write_init(w, proto)?;
+	for (i, binding, callee) in found {
+		list[i].inline_map.insert(binding, callee);
+	}
+}
+
+// a call a function is copied into the place of, by its index, and
+// whether the block it is in calls the shared helpers
+struct Site {
+	pc: usize,
+	call: Inst,
+	outline: bool,
+}
+
+// writes a function, or only its blocks in their own scope when it is
+// being copied into a caller at `site`
+fn write_function(
+	w: &mut dyn Write,
+	func: &Function,
+	list: &[Function],
+	site: Option<&Site>,
+) -> Result<()> {
+	let Function {
+		proto,
+		ref child_ref,
+		self_ref,
+		ref inline_map,
+		ref outline_list,
+		..
+	} = *func;
+
+	// none of the profile or debug information applies to a copy
+	let (is_counted, count_list, line_list) = match site {
+		Some(_) => (false, &None, &None),
+		None => (func.is_counted, &func.count_list, &func.line_list),
+	};
 
-	for (i, blk) in proto.block_list.iter().enumerate() {
-		writeln!(w, "label_{}:", i)?;
+	let prefix = site.map_or(String::new(), |v| format!("inline_{}_", v.pc));
+	let label = |i: u32| format!("{}label_{}", prefix, i);
+	let line_file = line_list.as_ref().and(func.source).and_then(line_file);
+
+	// blocks the entry does not dominate can never run
+	let order = reverse_postorder(&proto.block_list);
+	let idom = dominator_list(&proto.block_list, &order);
+	let mut unboxed = Unboxed::new(proto);
+	let chain_map = find_chains(proto, unboxed.infer());
+	let can_loop = site.is_none() && can_loop(proto);
+	let num_resume = 1 + proto
+		.block_list
+		.iter()
+		.zip(&idom)
+		.filter(|v| v.1.is_some())
+		.flat_map(|v| v.0.code.iter())
+		.filter(|v| matches!(as_op_type(v.opcode()), OpType::Yield))
+		.count();
+
+	// blocks the profile never saw run go after the others, as long
+	// as the entry did run so it stays the first one
+	let mut layout: Vec<usize> = (0..idom.len()).filter(|&v| idom[v].is_some()).collect();
+	let cold = |i: usize| match count_list {
+		Some(list) => list[0] != 0 && is_cold(list, &proto.block_list[i].pred_list, i),
+		None => false,
+	};
+
+	if let Some(list) = count_list.as_ref().filter(|v| v[0] != 0) {
+		layout.sort_by_key(|&v| list[v] == 0);
+	}
+
+	let start_list: Vec<usize> = proto
+		.block_list
+		.iter()
+		.scan(0, |start, blk| {
+			*start += blk.code.len();
+			Some(*start - blk.code.len())
+		})
+		.collect();
+
+	// the resume points are only known once the body is written
+	let mut body = Vec::new();
+	let mut resume_list = Vec::new();
+	let w_func = w;
+	let w: &mut dyn Write = &mut body;
+
+	for (position, &i) in layout.iter().enumerate() {
+		let blk = &proto.block_list[i];
+		let start = start_list[i];
+
+		if cold(i) {
+			writeln!(w, "{}: LEAN_COLD_LABEL;", label(i as u32))?;
+		} else {
+			writeln!(w, "{}:", label(i as u32))?;
+		}
+
+		if is_counted {
+			write!(w, "lua_count_{}[{}]++;", func.id, i)?;
+		}
 
 		let mut iter = blk.code.iter();
+		let mut last_line = None;
+
+		unboxed.reset(i);
+
+		let outline = site.map_or(outline_list[i], |v| v.outline);
 
 		while let Some(inst) = iter.next() {
-			let ci = match as_op_type(inst.opcode()) {
+			let pc = start + blk.code.len() - iter.len() - 1;
+			let op_type = as_op_type(inst.opcode());
+
+			if let (Some(list), Some(file)) = (line_list, line_file) {
+				let line = list.get(pc).copied().filter(|&v| v != 0);
+
+				if line.is_some() && line != last_line {
+					write_line(w, line.unwrap(), file)?;
+					last_line = line;
+				}
+			}
+			let (on_true, on_false) = match op_type {
+				OpType::Control => {
+					let lbl = assume_label(&blk.target);
+					let next = blk.next.unwrap_or(lbl);
+
+					(label(lbl), label(next))
+				}
+				_ => Default::default(),
+			};
+
+			if unboxed.write(w, pc, *inst, &on_true, &on_false)? {
+				// the metamethod fallback is never needed on numbers
+				if let OpType::Skip = op_type {
+					iter.next();
+				}
+
+				continue;
+			}
+
+			if let OpType::Yield = op_type {
+				unboxed.write_spill(w, pc, *inst)?;
+			} else {
+				unboxed.write_flush(w, pc)?;
+			}
+
+			let ci = match op_type {
 				OpType::Normal => "".to_string(),
 				OpType::Extra if inst.opcode() == Opcode::SetList && !inst.k() => ", 0".to_string(),
 				OpType::Extra => {
@@ -206,49 +568,1024 @@ fn write_function(w: &mut dyn Write, index: &mut usize, proto: &Proto) -> Result
 				OpType::Skip => {
 					let tail = iter.next().expect("trailing instruction not found");
 
-					format!(", {:?}({:#010x})", tail.opcode(), tail.inner)
+					if outline {
+						format!(", op_outline({:?}, {:#010x}, i)", tail.opcode(), tail.inner)
+					} else {
+						format!(", {:?}({:#010x})", tail.opcode(), tail.inner)
+					}
 				}
-				OpType::Control => {
-					let lbl = assume_label(&blk.target);
+				OpType::Control => format!(", {}, {}", on_true, on_false),
+				OpType::Closure => {
+					let child = &list[child_ref[inst.bx() as usize]];
 
-					format!(", label_{}, label_{}", lbl, i + 1)
+					format!(", lua_func_{}", child.id)
 				}
-				OpType::Closure => {
-					let index = child_ref[inst.bx() as usize];
+				OpType::Yield => {
+					resume_list.push(unboxed.reload(pc, *inst));
+
+					let id = resume_list.len();
+					let ctx = resume_ctx(proto, id, num_resume);
 
-					format!(", lua_func_{}", index)
+					format!(", lua_cont_{}, {}, resume_{}", func.id, ctx, id)
 				}
 			};
 
-			write_instruction(w, *inst, &ci)?;
+			let before = &blk.code[..pc - start];
+			let through = &blk.code[..=pc - start];
+
+			// the copy returns to the caller by going on after the call
+			if let (Some(site), OpType::Normal) = (site, &op_type) {
+				if matches!(
+					inst.opcode(),
+					Opcode::Return | Opcode::Return0 | Opcode::Return1
+				) {
+					write!(
+						w,
+						"op_inline_return({:#010x}, {}, inline_{}_done);",
+						inst.inner,
+						i64::from(site.call.c()) - 1,
+						site.pc
+					)?;
+					unboxed.write_done(pc);
+					continue;
+				}
+			}
+
+			let callee = find_binding(before, *inst).and_then(|v| inline_map.get(&v));
+
+			if let Some(&callee) = callee {
+				let callee = &list[callee];
+
+				write!(
+					w,
+					"if (lua_is_inline({:#010x}, lua_func_{})) {{",
+					inst.inner, callee.id
+				)?;
+				write!(
+					w,
+					"op_inline_enter({:#010x}, {}, {});",
+					inst.inner, callee.proto.num_param, callee.proto.num_stack
+				)?;
+				let site = Site {
+					pc,
+					call: *inst,
+					outline,
+				};
+
+				write_function(w, callee, list, Some(&site))?;
+				write!(w, "}} else {{")?;
+				write_instruction(w, *inst, &ci)?;
+				writeln!(w, "}}")?;
+				write!(w, "inline_{}_done: lua_update_base(ci);", pc)?;
+				unboxed.write_done(pc);
+				continue;
+			}
+
+			let intrinsic = find_intrinsic(before, *inst, &proto.value_list);
+			let is_select =
+				|call: Inst, code: &[Inst]| is_vararg_select(code, call, &proto.value_list);
+
+			// the varargs `select` reads are only copied if it falls back
+			let next = blk.code.get(pc - start + 1);
+
+			if inst.opcode() == Opcode::Vararg && next.map_or(false, |&v| is_select(v, through)) {
+				unboxed.write_done(pc);
+				continue;
+			}
+
+			let is_self = can_loop && is_self_call(before, *inst, self_ref, &proto.value_list);
+
+			match (chain_map.get(&pc), intrinsic) {
+				(Some(&chain), _) => write_chain(w, *inst, chain)?,
+				(None, _) if is_self => write!(
+					w,
+					"op_self_call({:#010x}, {}, {}, {:?}({:#010x}{}));",
+					inst.inner,
+					proto.num_param,
+					label(0),
+					inst.opcode(),
+					inst.inner,
+					ci
+				)?,
+				(None, Some(_)) if is_select(*inst, before) => write!(
+					w,
+					"op_vararg_select({:#010x}, {:#010x}, {:?}({:#010x}{}));",
+					inst.inner,
+					before.last().unwrap().inner,
+					inst.opcode(),
+					inst.inner,
+					ci
+				)?,
+				(None, Some(name)) => write!(
+					w,
+					"op_intrinsic({:#010x}, {}, {:?}({:#010x}{}));",
+					inst.inner,
+					name,
+					inst.opcode(),
+					inst.inner,
+					ci
+				)?,
+				(None, None) if outline && is_outlined(inst.opcode()) => {
+					write_outline(w, *inst, &ci)?
+				}
+				(None, None) => write_instruction(w, *inst, &ci)?,
+			}
+
+			unboxed.write_done(pc);
 		}
+
+		// threaded or reordered blocks may not be laid out before their
+		// fallthrough anymore
+		let laid_out = layout.get(position + 1).copied();
+
+		match blk.next {
+			Some(next) if !blk.is_branch() && Some(next as usize) != laid_out => {
+				writeln!(w, "goto {};", label(next))?;
+			}
+			_ => {}
+		}
+	}
+
+	let w = w_func;
+
+	// the copy reads its registers, constants and upvalues in its own frame
+	if let Some(site) = site {
+		write!(w, "{{lua_inline_frame({:#010x});", site.call.inner)?;
+		unboxed.write_local_list(w)?;
+
+		if !chain_map.is_empty() {
+			writeln!(w, "LeanConcat concat_part;")?;
+		}
+
+		w.write_all(&body)?;
+		return writeln!(w, "}}");
+	}
+
+	// every function keeps its own counters, so they are written with it
+	if is_counted {
+		let len = proto.block_list.len();
+
+		writeln!(w, "unsigned long long lua_count_{}[{}];", func.id, len)?;
 	}
 
+	// the main chunk is defined on line 0, which `#line` cannot name
+	if let Some(file) = line_file {
+		write_line(w, proto.line_defined.max(1), file)?;
+	}
+
+	// functions the profile never saw run are kept away from the rest
+	if matches!(count_list, Some(list) if list[0] == 0) {
+		write!(w, "LEAN_COLD_FUNC ")?;
+	}
+
+	write!(
+		w,
+		"int lua_cont_{}(lua_State* L, int status, lua_KContext ctx) {{",
+		func.id
+	)?;
+	write_init(w, proto, &unboxed, num_resume)?;
+
+	if !chain_map.is_empty() {
+		writeln!(w, "LeanConcat concat_part;")?;
+	}
+
+	write_resume_list(w, &resume_list, num_resume)?;
+	w.write_all(&body)?;
+	writeln!(w, "}}")?;
+	writeln!(w)?;
+
+	writeln!(w, "int lua_func_{}(lua_State* L) {{", func.id)?;
+	writeln!(w, "return luaA_enter(L, lua_cont_{});", func.id)?;
 	writeln!(w, "}}")?;
 	writeln!(w)
 }
 
-fn write_call_site(w: &mut dyn Write, proto: &Proto) -> Result<()> {
+// module names are written with octal escapes as those, unlike
+// hexadecimal ones, cannot run into the characters after them
+fn write_c_string(w: &mut dyn Write, data: &[u8]) -> Result<()> {
+	write!(w, "\"")?;
+
+	for &v in data {
+		if v.is_ascii_graphic() && !matches!(v, b'"' | b'\\' | b'?') || v == b' ' {
+			write!(w, "{}", char::from(v))?;
+		} else {
+			write!(w, "\\{:03o}", v)?;
+		}
+	}
+
+	write!(w, "\"")
+}
+
+fn write_glue(w: &mut dyn Write, name: &str, proto: &Proto) -> Result<usize> {
 	let dumped = dump_lua_module(proto)?;
-	let len = dumped.len().to_string();
 
-	write!(w, "char const* BT_GLUE = \"")?;
+	write!(w, "char const {}[] = \"", name)?;
 
-	for v in dumped {
+	for v in &dumped {
 		write!(w, "\\x{:02X?}", v)?;
 	}
 
 	writeln!(w, "\";")?;
 	writeln!(w)?;
-	write!(w, "{}", LUA_SETUP_BOILERPLATE.replace("`LENGTH`", &len))
+
+	Ok(dumped.len())
 }
 
-pub fn transpile(w: &mut dyn Write, proto: &Proto) -> Result<()> {
-	let mut index = 0;
+// the strings of a module, each one interned once when it is loaded
+#[derive(Default)]
+struct StringList<'a> {
+	list: Vec<&'a [u8]>,
+	map: HashMap<&'a [u8], usize>,
+}
+
+impl<'a> StringList<'a> {
+	fn intern(&mut self, data: &'a [u8]) -> usize {
+		let list = &mut self.list;
+
+		*self.map.entry(data).or_insert_with(|| {
+			list.push(data);
+			list.len() - 1
+		})
+	}
+}
+
+fn write_static_constant<'a>(
+	w: &mut dyn Write,
+	value: &Value<'a>,
+	string_list: &mut StringList<'a>,
+) -> Result<()> {
+	match value {
+		Value::Nil | Value::NoString => write!(w, "{{LUA_VNIL}}"),
+		Value::False => write!(w, "{{LUA_VFALSE}}"),
+		Value::True => write!(w, "{{LUA_VTRUE}}"),
+		Value::Integer(_) => write!(w, "{{LUA_VNUMINT, {{.i = {}}}}}", literal(value)),
+		Value::Number(_) => write!(w, "{{LUA_VNUMFLT, {{.n = {}}}}}", literal(value)),
+		Value::String(data) => {
+			let tt = if data.len() <= LUAI_MAXSHORTLEN {
+				"LUA_VSHRSTR"
+			} else {
+				"LUA_VLNGSTR"
+			};
+
+			write!(w, "{{{}, {{.s = {}}}}}", tt, string_list.intern(data))
+		}
+	}
+}
+
+// writes the static data of a prototype after that of its children,
+// numbered the same way as `list_function` numbers the functions
+fn write_static_proto<'a>(
+	w: &mut dyn Write,
+	index: &mut usize,
+	proto: &Proto<'a>,
+	string_list: &mut StringList<'a>,
+) -> Result<usize> {
+	let saved = *index;
+	let mut child_ref = Vec::with_capacity(proto.child_list.len());
+
+	for child in &proto.child_list {
+		*index += 1;
+		child_ref.push(write_static_proto(w, index, child, string_list)?);
+	}
+
+	let mut k = "NULL".to_string();
+	let mut upvalues = "NULL".to_string();
+	let mut p = "NULL".to_string();
+
+	if !proto.value_list.is_empty() {
+		k = format!("lua_k_{}", saved);
+		write!(w, "static LeanConstant const {}[] = {{", k)?;
+
+		for value in &proto.value_list {
+			write_static_constant(w, value, string_list)?;
+			write!(w, ", ")?;
+		}
+
+		writeln!(w, "}};")?;
+	}
+
+	if !proto.upval_list.is_empty() {
+		upvalues = format!("lua_upval_{}", saved);
+		write!(w, "static Upvaldesc const {}[] = {{", upvalues)?;
+
+		for upv in &proto.upval_list {
+			let in_stack = u8::from(upv.in_stack);
+
+			write!(w, "{{.instack = {}, .idx = {}}}, ", in_stack, upv.index)?;
+		}
+
+		writeln!(w, "}};")?;
+	}
+
+	if !child_ref.is_empty() {
+		p = format!("lua_child_{}", saved);
+		write!(w, "static LeanProto const *const {}[] = {{", p)?;
+
+		for child in child_ref {
+			write!(w, "&lua_proto_{}, ", child)?;
+		}
+
+		writeln!(w, "}};")?;
+	}
+
+	writeln!(
+		w,
+		"static LeanProto const lua_proto_{} = {{{}, {}, {}, {}, {}, {}, {}, {}, {}}};",
+		saved,
+		proto.num_param,
+		proto.is_vararg,
+		proto.num_stack,
+		proto.value_list.len(),
+		proto.upval_list.len(),
+		proto.child_list.len(),
+		k,
+		upvalues,
+		p
+	)?;
+
+	Ok(saved)
+}
+
+// writes the data a module is loaded from and returns its initializer
+fn write_module(
+	w: &mut dyn Write,
+	id: usize,
+	name: &[u8],
+	proto: &Proto,
+	root: usize,
+	func: &str,
+	static_proto: bool,
+) -> Result<String> {
+	let mut result = Vec::new();
+
+	write!(result, "{{")?;
+	write_c_string(&mut result, name)?;
+
+	if static_proto {
+		let mut string_list = StringList::default();
+		let mut index = root;
+		let mut str = "NULL".to_string();
+
+		write_static_proto(w, &mut index, proto, &mut string_list)?;
+
+		if !string_list.list.is_empty() {
+			str = format!("lua_string_{}", id);
+			write!(w, "static LeanString const {}[] = {{", str)?;
+
+			for data in &string_list.list {
+				write!(w, "{{")?;
+				write_c_string(w, data)?;
+				write!(w, ", {}}}, ", data.len())?;
+			}
+
+			writeln!(w, "}};")?;
+		}
+
+		writeln!(w)?;
+		write!(
+			result,
+			", NULL, 0, &lua_proto_{}, {}, {}",
+			root,
+			str,
+			string_list.list.len()
+		)?;
+	} else {
+		let glue = match id {
+			0 => "BT_GLUE".to_string(),
+			_ => format!("BT_GLUE_{}", id),
+		};
+		let size = write_glue(w, &glue, proto)?;
+
+		write!(result, ", {}, {}, NULL, NULL, 0", glue, size)?;
+	}
+
+	write!(result, ", lua_func_{}}}", func)?;
+
+	Ok(String::from_utf8(result).unwrap())
+}
+
+fn write_call_site(
+	w: &mut dyn Write,
+	proto: &Proto,
+	module_list: &[Module],
+	list: &[Function],
+	root_list: &[usize],
+	static_proto: bool,
+) -> Result<()> {
+	let id_of = |root: usize| &list.iter().find(|v| v.index == root).unwrap().id;
+	let entry = write_module(w, 0, b"main", proto, 0, id_of(0), static_proto)?;
+	let mut entry_list = String::new();
+
+	for (i, (module, &root)) in module_list.iter().zip(root_list).enumerate() {
+		let name = module.name.as_bytes();
+		let module = write_module(
+			w,
+			i + 1,
+			name,
+			&module.proto,
+			root,
+			id_of(root),
+			static_proto,
+		)?;
+
+		entry_list.push_str(&module);
+		entry_list.push_str(", ");
+	}
+
+	let setup = LUA_SETUP_BOILERPLATE
+		.replace("`ENTRY`", &entry)
+		.replace("`MODULE_LIST`", &entry_list);
+
+	write!(w, "{}", setup)
+}
+
+// the hash of everything the C of a function is written from, which is
+// the function and the names of its children, what it was told by the
+// settings and the functions it copies into itself, none of which
+// depend on where the function is in the program
+fn cache_key(func: &Function, list: &[Function]) -> u128 {
+	let mut h = Digest::new();
+	let child_list: Vec<&str> = func.child_ref.iter().map(|&v| &*list[v].id).collect();
+	let mut inline_list: Vec<_> = func
+		.inline_map
+		.iter()
+		.map(|(binding, &v)| (*binding, &*list[v].id, list[v].hash))
+		.collect();
+
+	inline_list.sort_unstable();
+
+	CACHE_VERSION.hash(&mut h);
+	func.hash.hash(&mut h);
+	func.id.hash(&mut h);
+	child_list.hash(&mut h);
+	func.is_counted.hash(&mut h);
+	func.count_list.hash(&mut h);
+	func.line_list.hash(&mut h);
+	func.line_list.as_ref().and(func.source).hash(&mut h);
+	func.self_ref.hash(&mut h);
+	inline_list.hash(&mut h);
+	func.outline_list.hash(&mut h);
+
+	h.finish_wide()
+}
+
+// functions found in the cache are read back as they were written before
+fn write_cached(
+	w: &mut Vec<u8>,
+	func: &Function,
+	list: &[Function],
+	cache: Option<&Cache>,
+) -> Result<()> {
+	let cache = match cache {
+		Some(cache) => cache,
+		None => return write_function(w, func, list, None),
+	};
+
+	let key = cache_key(func, list);
+
+	match cache.load(key) {
+		Some(data) => {
+			*w = data;
+
+			Ok(())
+		}
+		None => {
+			write_function(w, func, list, None)?;
+			cache.store(key, w)
+		}
+	}
+}
+
+// each function is written into its own buffer by a pool of workers, and
+// the buffers are handed back in order so the result matches a serial run
+fn write_function_list(
+	list: &[Function],
+	num_worker: usize,
+	cache: Option<&Cache>,
+) -> Result<Vec<Vec<u8>>> {
+	let next = AtomicUsize::new(0);
+	let worker = || -> Result<Vec<(usize, Vec<u8>)>> {
+		let mut done = Vec::new();
+
+		loop {
+			let i = next.fetch_add(1, Ordering::Relaxed);
+			let mut buf = Vec::new();
+
+			match list.get(i) {
+				Some(func) => write_cached(&mut buf, func, list, cache)?,
+				None => break,
+			}
+
+			done.push((i, buf));
+		}
+
+		Ok(done)
+	};
+
+	let result: Result<Vec<_>> = if num_worker <= 1 {
+		worker().map(|v| vec![v])
+	} else {
+		thread::scope(|s| {
+			let handle_list: Vec<_> = (0..num_worker.min(list.len()))
+				.map(|_| s.spawn(worker))
+				.collect();
+
+			handle_list
+				.into_iter()
+				.map(|v| v.join().expect("worker panicked"))
+				.collect()
+		})
+	};
+
+	let mut done: Vec<_> = result?.into_iter().flatten().collect();
+
+	done.sort_unstable_by_key(|v| v.0);
+
+	Ok(done.into_iter().map(|v| v.1).collect())
+}
+
+// declares the functions a file names, along with their counters and
+// the names they are given by `write_symbol_list`
+fn write_prototype_list(
+	w: &mut dyn Write,
+	func_list: &[&Function],
+	settings: &Settings,
+) -> Result<()> {
+	if settings.debug {
+		write_symbol_list(w, func_list)?;
+	}
+
+	for func in func_list {
+		writeln!(
+			w,
+			"int lua_cont_{}(lua_State* L, int status, lua_KContext ctx);",
+			func.id
+		)?;
+		writeln!(w, "int lua_func_{}(lua_State* L);", func.id)?;
+
+		if settings.profile {
+			writeln!(w, "extern unsigned long long lua_count_{}[];", func.id)?;
+		}
+	}
+
+	writeln!(w)
+}
+
+// the functions named by the C of the functions at `position_list`, which
+// are themselves, their children and those they are copied into
+fn referenced_list<'a>(position_list: &[usize], list: &'a [Function<'a>]) -> Vec<&'a Function<'a>> {
+	let mut func_list: Vec<_> = position_list
+		.iter()
+		.flat_map(|&v| {
+			let func = &list[v];
+
+			std::iter::once(v)
+				.chain(func.child_ref.iter().copied())
+				.chain(func.inline_map.values().copied())
+		})
+		.map(|v| &list[v])
+		.collect();
+
+	func_list.sort_unstable_by(|a, b| a.id.cmp(&b.id));
+	func_list.dedup_by(|a, b| a.id == b.id);
+	func_list
+}
+
+// hands every function to the shard its name picks, so it stays in that
+// shard for as long as it is unchanged and a changed function only
+// rewrites the shards it leaves and joins, where it is kept in name order
+fn assign_shard_list(list: &[Function], num_shard: usize) -> Vec<Vec<usize>> {
+	let mut shard_list = vec![Vec::new(); num_shard.max(1)];
+	let len = shard_list.len() as u64;
+
+	for (i, func) in list.iter().enumerate() {
+		shard_list[((func.hash >> 64) as u64 % len) as usize].push(i);
+	}
+
+	for shard in &mut shard_list {
+		shard.sort_unstable_by(|&a, &b| list[a].id.cmp(&list[b].id));
+	}
+
+	shard_list
+}
+
+fn write_makefile(w: &mut dyn Write, num_shard: usize) -> Result<()> {
+	writeln!(w, "LEAN_DIR := $(dir $(lastword $(MAKEFILE_LIST)))")?;
+	write!(w, "LEAN_OBJ :=")?;
+
+	for i in 0..num_shard {
+		write!(w, " $(LEAN_DIR)shard_{}.o", i)?;
+	}
+
+	writeln!(w, " $(LEAN_DIR)lean.o $(LEAN_DIR)main.o")?;
+	writeln!(w)?;
+	writeln!(w, "$(LEAN_OBJ): $(LEAN_DIR)lean.h")
+}
+
+fn write_boilerplate(w: &mut dyn Write, settings: &Settings) -> Result<()> {
+	if settings.profile {
+		writeln!(w, "#define LEAN_PROFILE")?;
+	}
+
+	writeln!(w, "{}", LUA_HEADER_BOILERPLATE)?;
+	writeln!(w, "{}", LUA_MACRO_BOILERPLATE)
+}
+
+// the opcodes some function calls the shared helper of, where functions
+// copied into others may be copied into blocks that call them
+fn outline_name_list(list: &[Function]) -> Vec<String> {
+	let mut name_list = Vec::new();
+	let mut is_copied = vec![false; list.len()];
+
+	if list.iter().all(|v| !v.outline_list.contains(&true)) {
+		return name_list;
+	}
+
+	for &callee in list.iter().flat_map(|v| v.inline_map.values()) {
+		is_copied[callee] = true;
+	}
+
+	for (func, &copied) in list.iter().zip(&is_copied) {
+		let block_list = &func.proto.block_list;
+
+		for (blk, &outline) in block_list.iter().zip(&func.outline_list) {
+			if !outline && !copied {
+				continue;
+			}
+
+			for inst in &blk.code {
+				let op = inst.opcode();
+
+				if is_outlined(op) || matches!(op, Opcode::MmBin | Opcode::MmBinI | Opcode::MmBinK)
+				{
+					name_list.push(format!("{:?}", op));
+				}
+			}
+		}
+	}
+
+	name_list
+}
+
+// writes the helpers, where those of library functions and rarely run
+// opcodes are only defined when some function calls them
+fn write_helper_list(w: &mut dyn Write, list: &[Function]) -> Result<()> {
+	let mut name_list: Vec<_> = list
+		.iter()
+		.flat_map(|v| helper_list(v.proto))
+		.map(|v| v.trim_start_matches("luaA_").to_string())
+		.chain(
+			outline_name_list(list)
+				.into_iter()
+				.map(|v| format!("outline_{}", v)),
+		)
+		.collect();
+
+	name_list.sort_unstable();
+	name_list.dedup();
+
+	for name in name_list {
+		writeln!(w, "#define LEAN_HAS_{}", name.to_ascii_uppercase())?;
+	}
+
+	writeln!(w)?;
+	writeln!(w, "{}", LUA_INTERP_BOILERPLATE)
+}
+
+// gives every block its own counter in the order the functions are written,
+// and hands every function the counts recorded for it if there are any and
+// they were recorded of the same function
+fn set_profile(list: &mut [Function], settings: &Settings) {
+	for func in list {
+		let len = func.proto.block_list.len();
+
+		func.is_counted = settings.profile;
+
+		if let Some(feedback) = &settings.feedback {
+			let source = func.source.unwrap_or(b"?");
+			let line = func.proto.line_defined;
+
+			func.count_list = feedback.count_list(func.index, source, line, len);
+		}
+	}
+}
+
+// picks the blocks of every function whose rarely run instructions call
+// their shared helpers instead of being expanded in place
+fn set_outline_list(list: &mut [Function], settings: &Settings) {
+	for func in list {
+		let block_list = &func.proto.block_list;
+		let len = block_list.len();
+
+		func.outline_list = match settings.opt_level {
+			OptLevel::Size => vec![true; len],
+			OptLevel::Balanced => {
+				let order = reverse_postorder(block_list);
+				let idom = dominator_list(block_list, &order);
+				let depth = loop_depth_list(block_list, &idom);
+				let cold = |i: usize| match &func.count_list {
+					Some(list) => list[0] != 0 && is_cold(list, &block_list[i].pred_list, i),
+					None => false,
+				};
+
+				(0..len).map(|i| depth[i] == 0 || cold(i)).collect()
+			}
+			OptLevel::Speed => vec![false; len],
+		};
+	}
+}
+
+// the name a closure is stored under, which is the field it is set in
+// right after it is made or else the local it is made in
+fn closure_name<'a>(
+	code: &[Inst],
+	pc: usize,
+	value_list: &[Value<'a>],
+	local_list: &[Local<'a>],
+) -> Option<&'a [u8]> {
+	let reg = code[pc].a();
+
+	if let Some(next) = code.get(pc + 1) {
+		let is_set = matches!(next.opcode(), Opcode::SetField | Opcode::SetTabUp);
+
+		if is_set && !next.k() && next.c() == reg {
+			return match value_list.get(next.b() as usize) {
+				Some(Value::String(name)) => Some(name),
+				_ => None,
+			};
+		}
+	}
+
+	// the locals active after the closure, counted as `luaF_getlocalname` does
+	let after = pc as u32 + 1;
+
+	local_list
+		.iter()
+		.take_while(|v| v.start_pc <= after)
+		.filter(|v| after < v.end_pc)
+		.nth(reg as usize)
+		.and_then(|v| v.name)
+}
+
+// hands every function the line of each of its instructions
+// and every child the name its parent stores it under
+fn set_debug_info(list: &mut [Function], settings: &Settings) {
+	if !settings.debug {
+		return;
+	}
+
+	let mut name_list = Vec::new();
+
+	for func in list.iter_mut() {
+		let proto = func.proto;
+		let info = load_debug_info(proto.debug_info);
+		let code: Vec<Inst> = proto
+			.block_list
+			.iter()
+			.flat_map(|v| v.code.iter().copied())
+			.collect();
+
+		for (pc, inst) in code.iter().enumerate() {
+			if inst.opcode() == Opcode::Closure {
+				let child = func.child_ref[inst.bx() as usize];
+				let name = closure_name(&code, pc, &proto.value_list, &info.local_list);
+
+				name_list.push((child, name));
+			}
+		}
+
+		func.line_list = Some(info.line_list(proto.line_defined));
+	}
+
+	for (child, name) in name_list {
+		list[child].name = name;
+	}
+}
+
+fn write_symbol_part(name: &mut String, data: &[u8]) {
+	name.push('_');
+	name.extend(data.iter().take(32).map(|&v| {
+		if v.is_ascii_alphanumeric() {
+			char::from(v)
+		} else {
+			'_'
+		}
+	}));
+}
+
+// renames the functions after the file and line they are defined on,
+// and what they are stored under, so they can be told apart in profilers
+// and debuggers while keeping their name to stay unique
+fn write_symbol_list(w: &mut dyn Write, func_list: &[&Function]) -> Result<()> {
+	for func in func_list {
+		let mut suffix = String::new();
+		let source = func.source.and_then(line_file).unwrap_or(b"chunk");
+		let file = source.rsplit(|&v| v == b'/' || v == b'\\').next().unwrap();
+
+		write_symbol_part(&mut suffix, file);
+		write_symbol_part(&mut suffix, func.proto.line_defined.to_string().as_bytes());
+
+		if let Some(name) = func.name {
+			write_symbol_part(&mut suffix, name);
+		}
+
+		for kind in &["cont", "func"] {
+			writeln!(
+				w,
+				"#define lua_{0}_{1} lua_{0}_{1}{2}",
+				kind, func.id, suffix
+			)?;
+		}
+	}
+
+	writeln!(w)
+}
+
+// writes the counters along with which function and lines the instructions
+// behind each one are on, sorted so the report can add up runs of them
+fn write_profile(w: &mut dyn Write, list: &[Function]) -> Result<()> {
+	let mut site_list = Vec::new();
+	let mut func_list: Vec<_> = list.iter().collect();
+
+	func_list.sort_by_key(|v| v.index);
+
+	for func in list {
+		let proto = func.proto;
+		let line_list = load_debug_info(proto.debug_info).line_list(proto.line_defined);
+		let mut pc = 0;
+
+		for (i, blk) in proto.block_list.iter().enumerate() {
+			let mut line_count: Vec<(u32, usize)> = Vec::new();
+
+			for _ in &blk.code {
+				let line = line_list.get(pc).copied().unwrap_or_default();
+
+				match line_count.iter_mut().find(|v| v.0 == line) {
+					Some(v) => v.1 += 1,
+					None => line_count.push((line, 1)),
+				}
+
+				pc += 1;
+			}
+
+			for (line, num_inst) in line_count {
+				site_list.push((func.index, line, i, num_inst));
+			}
+		}
+	}
+
+	site_list.sort_unstable();
+
+	writeln!(w, "static LeanFunction const lua_profile_func[] = {{")?;
+
+	for func in func_list {
+		let len = func.proto.block_list.len();
+
+		write!(w, "{{")?;
+		write_c_string(w, func.source.unwrap_or(b"?"))?;
+		writeln!(
+			w,
+			", {}, lua_count_{}, {}}},",
+			func.proto.line_defined, func.id, len
+		)?;
+	}
+
+	writeln!(w, "}};")?;
+	writeln!(w)?;
+	writeln!(w, "static LeanSite const lua_profile_site[] = {{")?;
+
+	for (func, line, block, num_inst) in site_list {
+		writeln!(w, "{{{}, {}, {}, {}}},", func, line, block, num_inst)?;
+	}
+
+	writeln!(w, "}};")?;
+	writeln!(w)
+}
+
+pub fn transpile(
+	w: &mut dyn Write,
+	proto: &Proto,
+	module_list: &[Module],
+	settings: &Settings,
+) -> Result<()> {
+	let mut list = Vec::new();
+
+	write_boilerplate(w, settings)?;
+
+	let root_list = list_bundle(&mut list, proto, module_list);
+
+	set_profile(&mut list, settings);
+	set_debug_info(&mut list, settings);
+	set_inline_list(&mut list, settings);
+	set_outline_list(&mut list, settings);
+	write_helper_list(w, &list)?;
+	write_prototype_list(w, &list.iter().collect::<Vec<_>>(), settings)?;
+
+	let body_list = write_function_list(&list, settings.num_worker, settings.cache.as_ref())?;
+
+	for body in body_list {
+		w.write_all(&body)?;
+	}
+
+	if settings.profile {
+		write_profile(w, &list)?;
+	}
+
+	write_call_site(
+		w,
+		proto,
+		module_list,
+		&list,
+		&root_list,
+		settings.static_proto,
+	)
+}
+
+// writes a shared header, a file with the helpers it declares, the functions
+// spread over `num_shard` files, a file with the entry point and a makefile
+// fragment listing the objects so the shards can be compiled in parallel
+pub fn transpile_dir(
+	dir: &Path,
+	proto: &Proto,
+	module_list: &[Module],
+	settings: &Settings,
+) -> Result<()> {
+	let mut list = Vec::new();
+	let root_list = list_bundle(&mut list, proto, module_list);
+
+	set_profile(&mut list, settings);
+	set_debug_info(&mut list, settings);
+	set_inline_list(&mut list, settings);
+	set_outline_list(&mut list, settings);
+
+	let body_list = write_function_list(&list, settings.num_worker, settings.cache.as_ref())?;
+	let shard_list = assign_shard_list(&list, settings.num_shard);
+
+	// files are only written when they change, so a build
+	// only compiles again the shards that did
+	let save = |name: &str, data: &[u8]| -> Result<()> {
+		let path = dir.join(name);
+
+		if std::fs::read(&path).map_or(true, |v| v != data) {
+			std::fs::write(path, data)?;
+		}
+
+		Ok(())
+	};
+
+	std::fs::create_dir_all(dir)?;
+
+	let w = &mut Vec::new();
+
+	writeln!(w, "#ifndef LEAN_H")?;
+	writeln!(w, "#define LEAN_H")?;
+	write_boilerplate(w, settings)?;
+	writeln!(w, "#endif")?;
+	save("lean.h", w)?;
+
+	let w = &mut Vec::new();
+
+	writeln!(w, "#include \"lean.h\"")?;
+	writeln!(w)?;
+	write_helper_list(w, &list)?;
+	save("lean.c", w)?;
+
+	for (i, shard) in shard_list.iter().enumerate() {
+		let w = &mut Vec::new();
+
+		writeln!(w, "#include \"lean.h\"")?;
+		writeln!(w)?;
+		write_prototype_list(w, &referenced_list(shard, &list), settings)?;
+
+		for &v in shard {
+			w.write_all(&body_list[v])?;
+		}
+
+		save(&format!("shard_{}.c", i), w)?;
+	}
+
+	let w = &mut Vec::new();
+
+	writeln!(w, "#include \"lean.h\"")?;
+	writeln!(w)?;
+	write_prototype_list(w, &list.iter().collect::<Vec<_>>(), settings)?;
+
+	if settings.profile {
+		write_profile(w, &list)?;
+	}
+
+	write_call_site(
+		w,
+		proto,
+		module_list,
+		&list,
+		&root_list,
+		settings.static_proto,
+	)?;
+	save("main.c", w)?;
 
-	writeln!(w, "{}", LUA_INTERP_BOILERPLATE)?;
-	writeln!(w, "{}", LUA_MACRO_BOILERPLATE)?;
+	let w = &mut Vec::new();
 
-	write_function(w, &mut index, proto)?;
-	write_call_site(w, proto)
+	write_makefile(w, shard_list.len())?;
+	save("lean.mk", w)
 }
@@ -0,0 +1,745 @@
+use crate::{
+	common::types::{Inst, Opcode, Proto, Value},
+	splitter::reverse_postorder,
+};
+use std::{collections::HashMap, ops::Range};
+
+// what a live range of a register is known to hold
+// `Unknown` is the bottom of the lattice and `Any` the top, so
+// a live range is unboxed only if every write to it agrees on a type
+#[derive(Clone, Copy, PartialEq, Eq, Debug)]
+pub enum Kind {
+	Unknown,
+	Integer,
+	Number,
+	Any,
+}
+
+impl Kind {
+	fn join(self, other: Self) -> Self {
+		match (self, other) {
+			(Kind::Unknown, v) | (v, Kind::Unknown) => v,
+			(a, b) if a == b => a,
+			_ => Kind::Any,
+		}
+	}
+
+	pub fn is_unboxed(self) -> bool {
+		matches!(self, Kind::Integer | Kind::Number)
+	}
+}
+
+#[derive(Clone, Copy)]
+pub enum Operand {
+	Register(usize),
+	Constant(usize),
+	Immediate(i32),
+}
+
+// an arithmetic instruction broken down into its operands and the
+// C operators for the integer and float cases, if either is valid
+pub struct Arith {
+	pub integer: Option<&'static str>,
+	pub number: Option<&'static str>,
+	pub lhs: Operand,
+	pub rhs: Operand,
+}
+
+impl Arith {
+	pub fn from_inst(inst: Inst) -> Option<Self> {
+		let reg_b = Operand::Register(inst.b() as usize);
+		let reg_c = Operand::Register(inst.c() as usize);
+		let k_c = Operand::Constant(inst.c() as usize);
+		let imm_c = Operand::Immediate(inst.sc());
+
+		let (integer, number, lhs, rhs) = match inst.opcode() {
+			Opcode::AddI => (Some("l_addi"), Some("luai_numadd"), reg_b, imm_c),
+			Opcode::AddK => (Some("l_addi"), Some("luai_numadd"), reg_b, k_c),
+			Opcode::SubK => (Some("l_subi"), Some("luai_numsub"), reg_b, k_c),
+			Opcode::MulK => (Some("l_muli"), Some("luai_nummul"), reg_b, k_c),
+			Opcode::ModK => (Some("luaV_mod"), Some("luaV_modf"), reg_b, k_c),
+			Opcode::PowK => (None, Some("luai_numpow"), reg_b, k_c),
+			Opcode::DivK => (None, Some("luai_numdiv"), reg_b, k_c),
+			Opcode::IDivK => (Some("luaV_idiv"), Some("luai_numidiv"), reg_b, k_c),
+			Opcode::BandK => (Some("l_band"), None, reg_b, k_c),
+			Opcode::BorK => (Some("l_bor"), None, reg_b, k_c),
+			Opcode::BxorK => (Some("l_bxor"), None, reg_b, k_c),
+			Opcode::ShrI => (Some("luaV_shiftr"), None, reg_b, imm_c),
+			Opcode::ShlI => (Some("luaV_shiftl"), None, imm_c, reg_b),
+			Opcode::Add => (Some("l_addi"), Some("luai_numadd"), reg_b, reg_c),
+			Opcode::Sub => (Some("l_subi"), Some("luai_numsub"), reg_b, reg_c),
+			Opcode::Mul => (Some("l_muli"), Some("luai_nummul"), reg_b, reg_c),
+			Opcode::Mod => (Some("luaV_mod"), Some("luaV_modf"), reg_b, reg_c),
+			Opcode::Pow => (None, Some("luai_numpow"), reg_b, reg_c),
+			Opcode::Div => (None, Some("luai_numdiv"), reg_b, reg_c),
+			Opcode::IDiv => (Some("luaV_idiv"), Some("luai_numidiv"), reg_b, reg_c),
+			Opcode::Band => (Some("l_band"), None, reg_b, reg_c),
+			Opcode::Bor => (Some("l_bor"), None, reg_b, reg_c),
+			Opcode::Bxor => (Some("l_bxor"), None, reg_b, reg_c),
+			Opcode::Shl => (Some("luaV_shiftl"), None, reg_b, reg_c),
+			Opcode::Shr => (Some("luaV_shiftr"), None, reg_b, reg_c),
+			_ => return None,
+		};
+
+		Some(Self {
+			integer,
+			number,
+			lhs,
+			rhs,
+		})
+	}
+
+	// bitwise operators are the only ones without a state argument
+	pub fn is_bitwise(&self) -> bool {
+		self.number.is_none()
+	}
+}
+
+// fixed size set of registers, as a function has at most 255
+#[derive(Clone, Copy, PartialEq, Eq, Default)]
+struct RegSet {
+	bits: [u64; 4],
+}
+
+impl RegSet {
+	fn contains(&self, reg: usize) -> bool {
+		self.bits[reg / 64] & 1 << (reg % 64) != 0
+	}
+
+	fn insert(&mut self, reg: usize) {
+		self.bits[reg / 64] |= 1 << (reg % 64);
+	}
+
+	fn union(&mut self, other: &Self) {
+		for (a, b) in self.bits.iter_mut().zip(other.bits.iter()) {
+			*a |= *b;
+		}
+	}
+
+	fn difference(&mut self, other: &Self) {
+		for (a, b) in self.bits.iter_mut().zip(other.bits.iter()) {
+			*a &= !*b;
+		}
+	}
+}
+
+fn find(parent: &mut Vec<usize>, mut node: usize) -> usize {
+	while parent[node] != node {
+		parent[node] = parent[parent[node]];
+		node = parent[node];
+	}
+
+	node
+}
+
+fn unite(parent: &mut Vec<usize>, a: usize, b: usize) {
+	let a = find(parent, a);
+	let b = find(parent, b);
+
+	parent[a] = b;
+}
+
+// registers written by an instruction, including those a call
+// overwrites with its frame while they are dead to the function
+pub fn write_range(inst: Inst, num_stack: usize) -> Range<usize> {
+	let a = inst.a() as usize;
+	let b = inst.b() as usize;
+	let c = inst.c() as usize;
+
+	let range = match inst.opcode() {
+		Opcode::LoadNil => a..a + b + 1,
+		Opcode::Method => a..a + 2,
+		Opcode::Concat => a..a + b,
+		Opcode::ForPrep | Opcode::ForLoop => a..a + 4,
+		Opcode::TForLoop => a + 2..a + 3,
+		Opcode::TForCall => a + 4..num_stack,
+		Opcode::Call | Opcode::TailCall => a..num_stack,
+		Opcode::Vararg if c == 0 => a..num_stack,
+		Opcode::Vararg => a..a + c - 1,
+		Opcode::Move
+		| Opcode::LoadI
+		| Opcode::LoadF
+		| Opcode::LoadK
+		| Opcode::LoadKX
+		| Opcode::LoadFalse
+		| Opcode::LFalseSkip
+		| Opcode::LoadTrue
+		| Opcode::GetUpval
+		| Opcode::GetTabUp
+		| Opcode::GetTable
+		| Opcode::GetI
+		| Opcode::GetField
+		| Opcode::NewTable
+		| Opcode::AddI
+		| Opcode::AddK
+		| Opcode::SubK
+		| Opcode::MulK
+		| Opcode::ModK
+		| Opcode::PowK
+		| Opcode::DivK
+		| Opcode::IDivK
+		| Opcode::BandK
+		| Opcode::BorK
+		| Opcode::BxorK
+		| Opcode::ShrI
+		| Opcode::ShlI
+		| Opcode::Add
+		| Opcode::Sub
+		| Opcode::Mul
+		| Opcode::Mod
+		| Opcode::Pow
+		| Opcode::Div
+		| Opcode::IDiv
+		| Opcode::Band
+		| Opcode::Bor
+		| Opcode::Bxor
+		| Opcode::Shl
+		| Opcode::Shr
+		| Opcode::Unm
+		| Opcode::Bnot
+		| Opcode::Not
+		| Opcode::Len
+		| Opcode::TestSet
+		| Opcode::Closure => a..a + 1,
+		_ => 0..0,
+	};
+
+	range.start.min(num_stack)..range.end.min(num_stack)
+}
+
+// flow sensitive type inference over the registers of a function
+// the writes of each register are grouped into live ranges, with writes
+// that reach a common read sharing one range, and every range whose
+// writes agree on being an integer or float can live in a C local
+pub struct Inference {
+	num_stack: usize,
+	parent: Vec<usize>,
+	kind_list: Vec<Kind>,
+	const_list: Vec<Kind>,
+	code: Vec<Inst>,
+	use_list: Vec<Vec<(usize, usize)>>,
+	def_list: Vec<Vec<(usize, usize)>>,
+	entry_list: Vec<Vec<(usize, usize)>>,
+	loop_map: HashMap<usize, (usize, usize)>,
+	captured: RegSet,
+}
+
+impl Inference {
+	pub fn new(proto: &Proto) -> Self {
+		let code: Vec<Inst> = proto
+			.block_list
+			.iter()
+			.flat_map(|v| v.code.iter().copied())
+			.collect();
+
+		let const_list = proto
+			.value_list
+			.iter()
+			.map(|v| match v {
+				Value::Integer(_) => Kind::Integer,
+				Value::Number(_) => Kind::Number,
+				_ => Kind::Any,
+			})
+			.collect();
+
+		let mut result = Self {
+			num_stack: usize::from(proto.num_stack),
+			parent: Vec::new(),
+			kind_list: Vec::new(),
+			const_list,
+			code,
+			use_list: Vec::new(),
+			def_list: Vec::new(),
+			entry_list: Vec::new(),
+			loop_map: HashMap::new(),
+			captured: RegSet::default(),
+		};
+
+		result.find_captured(proto);
+		result.find_loops();
+		result.build_ranges(proto);
+		result.solve(proto);
+		result
+	}
+
+	pub fn constant(&self, index: usize) -> Kind {
+		self.const_list.get(index).copied().unwrap_or(Kind::Any)
+	}
+
+	// the live range a register is read from at `pc`
+	pub fn use_range(&self, pc: usize, reg: usize) -> Option<usize> {
+		self.use_list[pc]
+			.iter()
+			.find(|v| v.0 == reg)
+			.map(|v| self.root(v.1))
+	}
+
+	// the live range a register is written to at `pc`
+	pub fn def_range(&self, pc: usize, reg: usize) -> Option<usize> {
+		self.def_list[pc]
+			.iter()
+			.find(|v| v.0 == reg)
+			.map(|v| self.root(v.1))
+	}
+
+	pub fn range_kind(&self, range: Option<usize>) -> Kind {
+		range.map_or(Kind::Any, |v| self.kind_list[v])
+	}
+
+	pub fn operand(&self, pc: usize, op: Operand) -> Kind {
+		match op {
+			Operand::Register(reg) => self.range_kind(self.use_range(pc, reg)),
+			Operand::Constant(index) => self.constant(index),
+			Operand::Immediate(_) => Kind::Integer,
+		}
+	}
+
+	pub fn arith_kind(&self, pc: usize, arith: &Arith) -> Kind {
+		match (self.operand(pc, arith.lhs), self.operand(pc, arith.rhs)) {
+			(Kind::Any, _) | (_, Kind::Any) => Kind::Any,
+			(Kind::Unknown, _) | (_, Kind::Unknown) => Kind::Unknown,
+			(Kind::Integer, Kind::Integer) if arith.integer.is_some() => Kind::Integer,
+			_ if arith.number.is_some() => Kind::Number,
+			_ => Kind::Any,
+		}
+	}
+
+	// a numeric `for` is unboxed only as an integer loop, and both its
+	// `ForPrep` and `ForLoop` must come to the same conclusion
+	pub fn loop_kind(&self, pc: usize) -> Kind {
+		let (prep, post) = match self.loop_map.get(&pc) {
+			Some(&pair) => pair,
+			None => return Kind::Any,
+		};
+
+		let a = self.code[prep].a() as usize;
+		let used = [
+			(prep, a),
+			(prep, a + 2),
+			(post, a),
+			(post, a + 1),
+			(post, a + 2),
+		];
+		let list = used
+			.iter()
+			.map(|v| self.use_range(v.0, v.1))
+			.chain((a..a + 4).map(|v| self.def_range(prep, v)))
+			.chain((a..a + 4).map(|v| self.def_range(post, v)));
+
+		for range in list {
+			match self.range_kind(range) {
+				Kind::Unknown | Kind::Integer => {}
+				_ => return Kind::Any,
+			}
+		}
+
+		Kind::Integer
+	}
+
+	// the `ForPrep` and `ForLoop` of every numeric loop
+	pub fn loop_list(&self) -> Vec<(usize, usize)> {
+		let mut list: Vec<_> = self
+			.loop_map
+			.iter()
+			.filter(|v| *v.0 == v.1 .0)
+			.map(|v| *v.1)
+			.collect();
+
+		list.sort_unstable();
+		list
+	}
+
+	// whether a register may be changed through an open upvalue
+	pub fn is_captured(&self, reg: usize) -> bool {
+		self.captured.contains(reg)
+	}
+
+	// live ranges that need a C local, along with their kind
+	pub fn local_list(&self) -> Vec<(usize, Kind)> {
+		(0..self.parent.len())
+			.filter(|&v| self.parent[v] == v && self.kind_list[v].is_unboxed())
+			.map(|v| (v, self.kind_list[v]))
+			.collect()
+	}
+
+	// the live range each register is in when entering a block
+	pub fn entry_list(&self, block: usize) -> Vec<(usize, usize)> {
+		self.entry_list[block]
+			.iter()
+			.map(|&(reg, node)| (reg, self.root(node)))
+			.collect()
+	}
+
+	pub fn use_list(&self, pc: usize) -> Vec<(usize, usize)> {
+		self.use_list[pc]
+			.iter()
+			.map(|&(reg, node)| (reg, self.root(node)))
+			.collect()
+	}
+
+	pub fn def_list(&self, pc: usize) -> Vec<(usize, usize)> {
+		self.def_list[pc]
+			.iter()
+			.map(|&(reg, node)| (reg, self.root(node)))
+			.collect()
+	}
+
+	fn root(&self, mut node: usize) -> usize {
+		while self.parent[node] != node {
+			node = self.parent[node];
+		}
+
+		node
+	}
+
+	fn span(&self, range: Range<usize>) -> Range<usize> {
+		range.start.min(self.num_stack)..range.end.min(self.num_stack)
+	}
+
+	// registers read by an instruction, where reads running up to the
+	// stack top stop at the values of the call or vararg before them
+	fn reads_of(&self, inst: Inst) -> Range<usize> {
+		let a = inst.a() as usize;
+		let b = inst.b() as usize;
+
+		let range = match inst.opcode() {
+			Opcode::Concat => a..a + b,
+			Opcode::ForLoop | Opcode::ForPrep | Opcode::TForCall => a..a + 3,
+			Opcode::TForPrep => a..a + 4,
+			Opcode::Call | Opcode::TailCall if b != 0 => a..a + b,
+			Opcode::Return if b != 0 => a..a + b - 1,
+			Opcode::SetList if b != 0 => a..a + b + 1,
+			Opcode::Call | Opcode::TailCall | Opcode::Return | Opcode::SetList => a..self.num_stack,
+			_ => 0..0,
+		};
+
+		self.span(range)
+	}
+
+	// registers read by an instruction, in any order
+	pub fn read_list(&self, inst: Inst) -> Vec<usize> {
+		let a = inst.a() as usize;
+		let b = inst.b() as usize;
+		let c = inst.c() as usize;
+		let rk_c = if inst.k() { None } else { Some(c) };
+
+		let list = match inst.opcode() {
+			Opcode::Move
+			| Opcode::GetI
+			| Opcode::GetField
+			| Opcode::Method
+			| Opcode::AddI
+			| Opcode::AddK
+			| Opcode::SubK
+			| Opcode::MulK
+			| Opcode::ModK
+			| Opcode::PowK
+			| Opcode::DivK
+			| Opcode::IDivK
+			| Opcode::BandK
+			| Opcode::BorK
+			| Opcode::BxorK
+			| Opcode::ShrI
+			| Opcode::ShlI
+			| Opcode::Unm
+			| Opcode::Bnot
+			| Opcode::Not
+			| Opcode::Len
+			| Opcode::TestSet => vec![b],
+			Opcode::GetTable
+			| Opcode::Add
+			| Opcode::Sub
+			| Opcode::Mul
+			| Opcode::Mod
+			| Opcode::Pow
+			| Opcode::Div
+			| Opcode::IDiv
+			| Opcode::Band
+			| Opcode::Bor
+			| Opcode::Bxor
+			| Opcode::Shl
+			| Opcode::Shr => vec![b, c],
+			Opcode::SetUpval
+			| Opcode::Tbc
+			| Opcode::EqK
+			| Opcode::EqI
+			| Opcode::LtI
+			| Opcode::LeI
+			| Opcode::GtI
+			| Opcode::GeI
+			| Opcode::Test
+			| Opcode::Return1 => vec![a],
+			Opcode::Eq | Opcode::Lt | Opcode::Le => vec![a, b],
+			Opcode::SetTabUp => rk_c.into_iter().collect(),
+			Opcode::SetTable => std::iter::once(a).chain(Some(b)).chain(rk_c).collect(),
+			Opcode::SetI | Opcode::SetField => std::iter::once(a).chain(rk_c).collect(),
+			Opcode::TForLoop => vec![a + 4],
+			_ => self.reads_of(inst).collect(),
+		};
+
+		list.into_iter().filter(|&v| v < self.num_stack).collect()
+	}
+
+	fn writes_of(&self, inst: Inst) -> Range<usize> {
+		write_range(inst, self.num_stack)
+	}
+
+	// the kind an instruction writes to one of its registers
+	fn write_kind(&self, pc: usize, reg: usize) -> Kind {
+		let inst = self.code[pc];
+		let a = inst.a() as usize;
+
+		if self.captured.contains(reg) {
+			return Kind::Any;
+		}
+
+		if let Some(arith) = Arith::from_inst(inst) {
+			return self.arith_kind(pc, &arith);
+		}
+
+		let b = Operand::Register(inst.b() as usize);
+
+		match inst.opcode() {
+			Opcode::Move | Opcode::Unm => self.operand(pc, b),
+			Opcode::Bnot => match self.operand(pc, b) {
+				Kind::Unknown => Kind::Unknown,
+				Kind::Integer => Kind::Integer,
+				_ => Kind::Any,
+			},
+			Opcode::LoadI => Kind::Integer,
+			Opcode::LoadF => Kind::Number,
+			Opcode::LoadK => self.constant(inst.bx() as usize),
+			Opcode::ForPrep | Opcode::ForLoop if reg < a + 4 => self.loop_kind(pc),
+			_ => Kind::Any,
+		}
+	}
+
+	// registers captured by closures share their stack slot with an open
+	// upvalue, so they can never be moved into a C local
+	fn find_captured(&mut self, proto: &Proto) {
+		for inst in self.code.iter().filter(|v| v.opcode() == Opcode::Closure) {
+			let child = &proto.child_list[inst.bx() as usize];
+
+			for upv in child.upval_list.iter().filter(|v| v.in_stack) {
+				self.captured.insert(usize::from(upv.index));
+			}
+		}
+	}
+
+	fn find_loops(&mut self) {
+		for (pc, inst) in self.code.iter().enumerate() {
+			if inst.opcode() != Opcode::ForPrep {
+				continue;
+			}
+
+			let post = pc + inst.bx() as usize + 1;
+			let valid = self
+				.code
+				.get(post)
+				.filter(|v| v.opcode() == Opcode::ForLoop && v.a() == inst.a());
+
+			if valid.is_some() {
+				self.loop_map.insert(pc, (pc, post));
+				self.loop_map.insert(post, (pc, post));
+			}
+		}
+	}
+
+	fn find_liveness(&self, proto: &Proto) -> Vec<RegSet> {
+		let len = proto.block_list.len();
+		let mut gen_list = vec![RegSet::default(); len];
+		let mut kill_list = vec![RegSet::default(); len];
+		let mut pc = 0;
+
+		for (i, blk) in proto.block_list.iter().enumerate() {
+			for &inst in &blk.code {
+				for reg in self.read_list(inst) {
+					if !kill_list[i].contains(reg) {
+						gen_list[i].insert(reg);
+					}
+				}
+
+				for reg in self.writes_of(inst) {
+					kill_list[i].insert(reg);
+				}
+
+				pc += 1;
+			}
+		}
+
+		let succ_list: Vec<_> = proto
+			.block_list
+			.iter()
+			.map(|v| v.successor_list())
+			.collect();
+
+		// a backwards problem settles fastest when walked in postorder,
+		// with the unreachable blocks tacked on after
+		let mut order = reverse_postorder(&proto.block_list);
+		let mut seen = vec![false; len];
+
+		order.reverse();
+		order.iter().for_each(|&v| seen[v] = true);
+		order.extend((0..len).filter(|&v| !seen[v]));
+
+		let mut live_in = vec![RegSet::default(); len];
+		let mut changed = true;
+
+		while changed {
+			changed = false;
+
+			for &i in &order {
+				let mut live = RegSet::default();
+
+				for &succ in &succ_list[i] {
+					live.union(&live_in[succ]);
+				}
+
+				live.difference(&kill_list[i]);
+				live.union(&gen_list[i]);
+
+				if live != live_in[i] {
+					live_in[i] = live;
+					changed = true;
+				}
+			}
+		}
+
+		debug_assert_eq!(pc, self.code.len());
+		live_in
+	}
+
+	// walks each block with the current live range of every register,
+	// joining ranges that flow into the same register at a block entry
+	fn build_ranges(&mut self, proto: &Proto) {
+		let live_in = self.find_liveness(proto);
+		let mut parent = Vec::new();
+		let new_node = |parent: &mut Vec<usize>| {
+			parent.push(parent.len());
+			parent.len() - 1
+		};
+
+		let mut entry_node = vec![Vec::new(); proto.block_list.len()];
+
+		for (i, live) in live_in.iter().enumerate() {
+			for reg in (0..self.num_stack).filter(|&v| live.contains(v)) {
+				entry_node[i].push((reg, new_node(&mut parent)));
+			}
+		}
+
+		let mut pc = 0;
+
+		for (i, blk) in proto.block_list.iter().enumerate() {
+			let mut current = vec![None; self.num_stack];
+
+			for &(reg, node) in &entry_node[i] {
+				current[reg] = Some(node);
+			}
+
+			for &inst in &blk.code {
+				let used: Vec<_> = self
+					.read_list(inst)
+					.into_iter()
+					.filter_map(|reg| current[reg].map(|node| (reg, node)))
+					.collect();
+
+				let mut defined = Vec::new();
+
+				for reg in self.writes_of(inst) {
+					let node = new_node(&mut parent);
+
+					current[reg] = Some(node);
+					defined.push((reg, node));
+				}
+
+				// the loop registers are updated in place
+				let a = inst.a() as usize;
+				let in_place: &[usize] = match inst.opcode() {
+					Opcode::ForPrep => &[0, 2],
+					Opcode::ForLoop => &[0, 1, 2],
+					_ => &[],
+				};
+
+				for &offset in in_place {
+					let old = used.iter().find(|v| v.0 == a + offset);
+					let new = defined.iter().find(|v| v.0 == a + offset);
+
+					if let (Some(old), Some(new)) = (old, new) {
+						unite(&mut parent, old.1, new.1);
+					}
+				}
+
+				self.use_list.push(used);
+				self.def_list.push(defined);
+				pc += 1;
+			}
+
+			for succ in blk.successor_list() {
+				for &(reg, node) in &entry_node[succ] {
+					if let Some(old) = current[reg] {
+						unite(&mut parent, old, node);
+					}
+				}
+			}
+		}
+
+		debug_assert_eq!(pc, self.code.len());
+
+		for v in 0..parent.len() {
+			find(&mut parent, v);
+		}
+
+		self.parent = parent;
+		self.entry_list = entry_node;
+	}
+
+	fn solve(&mut self, proto: &Proto) {
+		self.kind_list = vec![Kind::Unknown; self.parent.len()];
+
+		// whatever is live when the function starts is a parameter or
+		// garbage, both of which arrive boxed
+		if let Some(list) = self.entry_list.first() {
+			for &(_, node) in list {
+				let root = self.root(node);
+
+				self.kind_list[root] = Kind::Any;
+			}
+		}
+
+		// anything still unknown after solving is never written with a known
+		// kind, so it is given up on and the solution is refreshed
+		loop {
+			let mut changed = true;
+
+			while changed {
+				changed = false;
+
+				for pc in 0..self.code.len() {
+					for (reg, node) in self.def_list(pc) {
+						let kind = self.write_kind(pc, reg);
+						let joined = self.kind_list[node].join(kind);
+
+						changed |= joined != self.kind_list[node];
+						self.kind_list[node] = joined;
+					}
+				}
+			}
+
+			let mut done = true;
+
+			for v in self.kind_list.iter_mut().filter(|v| **v == Kind::Unknown) {
+				*v = Kind::Any;
+				done = false;
+			}
+
+			if done {
+				break;
+			}
+		}
+
+		debug_assert_eq!(
+			self.code.len(),
+			proto.block_list.iter().map(|v| v.code.len()).sum()
+		);
+	}
+}
@@ -0,0 +1,123 @@
+use crate::{
+	codegen::{infer::write_range, intrinsic::find_load},
+	common::types::{Inst, Opcode, Proto},
+};
+use std::ops::Range;
+
+// functions with more instructions than this are not copied into callers
+const INLINE_LIMIT: usize = 32;
+
+// where a caller can load a function it may have copied in place of calls
+#[derive(Clone, Copy, PartialEq, Eq, PartialOrd, Ord, Hash)]
+pub enum Binding {
+	Local(u32),
+	Upval(u32),
+}
+
+fn code_of<'a>(proto: &'a Proto) -> impl Iterator<Item = Inst> + 'a {
+	proto.block_list.iter().flat_map(|v| v.code.iter().copied())
+}
+
+// whether a function can be copied into the place of a call to it, which
+// needs it to finish without calling, yielding or looping, and without
+// anything on its frame outliving it
+pub fn is_inlinable(proto: &Proto) -> bool {
+	let mut len = 0;
+
+	proto.is_vararg == 0
+		&& proto.child_list.is_empty()
+		&& code_of(proto).all(|inst| {
+			len += 1;
+
+			match inst.opcode() {
+				Opcode::Call
+				| Opcode::TailCall
+				| Opcode::TForPrep
+				| Opcode::TForCall
+				| Opcode::TForLoop
+				| Opcode::ForPrep
+				| Opcode::ForLoop
+				| Opcode::Closure
+				| Opcode::Vararg
+				| Opcode::VarargPrep
+				| Opcode::Close
+				| Opcode::Tbc => false,
+				Opcode::Return => !inst.k(),
+				_ => true,
+			}
+		}) && len <= INLINE_LIMIT
+}
+
+// whether a function or any function inside it sets one of its upvalues
+fn sets_upval(proto: &Proto, upval: u32) -> bool {
+	code_of(proto).any(|v| v.opcode() == Opcode::SetUpval && v.b() == upval)
+		|| proto.child_list.iter().any(|child| {
+			child
+				.upval_list
+				.iter()
+				.enumerate()
+				.filter(|v| !v.1.in_stack && u32::from(v.1.index) == upval)
+				.any(|v| sets_upval(child, v.0 as u32))
+		})
+}
+
+// registers an instruction leaves a value in, where calls only count for
+// their results as the frame they clobber is above every live local
+fn result_range(inst: Inst, num_stack: usize) -> Range<usize> {
+	let a = inst.a() as usize;
+	let c = inst.c() as usize;
+
+	match inst.opcode() {
+		Opcode::Call if c != 0 => a..(a + c - 1).min(num_stack),
+		_ => write_range(inst, num_stack),
+	}
+}
+
+// the registers of a function that are only ever set by making one of its
+// children, neither by any other instruction nor through an upvalue, along
+// with the index of that child
+pub fn constant_closure_list(proto: &Proto) -> Vec<(u32, usize)> {
+	let num_stack = usize::from(proto.num_stack);
+	let code: Vec<Inst> = code_of(proto).collect();
+	let mut list = Vec::new();
+
+	for inst in code.iter().filter(|v| v.opcode() == Opcode::Closure) {
+		let reg = inst.a();
+		let written = code
+			.iter()
+			.filter(|v| result_range(**v, num_stack).contains(&(reg as usize)))
+			.count();
+
+		let captured = proto.child_list.iter().any(|child| {
+			child
+				.upval_list
+				.iter()
+				.enumerate()
+				.filter(|v| v.1.in_stack && u32::from(v.1.index) == reg)
+				.any(|v| sets_upval(child, v.0 as u32))
+		});
+
+		if written == 1 && !captured {
+			list.push((reg, inst.bx() as usize));
+		}
+	}
+
+	list
+}
+
+// the binding a call loaded its callee from, going by the instructions
+// of its block before it; only calls with a known number of arguments
+// are worth copying a function into
+pub fn find_binding(code: &[Inst], call: Inst) -> Option<Binding> {
+	if call.opcode() != Opcode::Call || call.b() == 0 {
+		return None;
+	}
+
+	let (_, load) = find_load(code, call.a())?;
+
+	match load.opcode() {
+		Opcode::GetUpval => Some(Binding::Upval(load.b())),
+		Opcode::Move => Some(Binding::Local(load.b())),
+		_ => None,
+	}
+}
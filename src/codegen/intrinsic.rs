@@ -0,0 +1,100 @@
+use crate::common::types::{Inst, Opcode, Proto, Value};
+
+// library functions whose calls can be done inline, by the global table
+// they are in and their name, along with the helper doing them
+const INTRINSIC_LIST: &[(Option<&[u8]>, &[u8], &str)] = &[
+	(None, b"ipairs", "luaA_ipairs"),
+	(None, b"pairs", "luaA_pairs"),
+	(None, b"rawget", "luaA_rawget"),
+	(None, b"select", "luaA_select"),
+	(None, b"type", "luaA_type"),
+	(Some(b"math"), b"abs", "luaA_math_abs"),
+	(Some(b"math"), b"floor", "luaA_math_floor"),
+	(Some(b"string"), b"byte", "luaA_string_byte"),
+	(Some(b"string"), b"sub", "luaA_string_sub"),
+	(Some(b"table"), b"insert", "luaA_table_insert"),
+];
+
+fn constant<'a>(value_list: &[Value<'a>], index: u32) -> Option<&'a [u8]> {
+	match value_list.get(index as usize) {
+		Some(Value::String(data)) => Some(data),
+		_ => None,
+	}
+}
+
+// the last instruction before the end of `code` to write a register
+pub fn find_load(code: &[Inst], reg: u32) -> Option<(&[Inst], Inst)> {
+	let index = code.iter().rposition(|v| v.a() == reg)?;
+
+	Some((&code[..index], code[index]))
+}
+
+// the library function a call is to, going by how the instructions of its
+// block before it loaded the callee; this is only a guess, and the helper
+// checks whether it was right every time the call runs
+pub fn find_intrinsic(code: &[Inst], call: Inst, value_list: &[Value]) -> Option<&'static str> {
+	if call.opcode() != Opcode::Call {
+		return None;
+	}
+
+	let (before, load) = find_load(code, call.a())?;
+	let (lib, name) = match load.opcode() {
+		Opcode::GetTabUp => (None, constant(value_list, load.c())?),
+		Opcode::GetField => {
+			let (_, table) = find_load(before, load.b())?;
+
+			if table.opcode() != Opcode::GetTabUp {
+				return None;
+			}
+
+			let lib = constant(value_list, table.c())?;
+
+			(Some(lib), constant(value_list, load.c())?)
+		}
+		// methods are mostly called on strings
+		Opcode::Method if load.k() => (Some(&b"string"[..]), constant(value_list, load.c())?),
+		_ => return None,
+	};
+
+	INTRINSIC_LIST
+		.iter()
+		.find(|v| v.0 == lib && v.1 == name)
+		.map(|v| v.2)
+}
+
+// whether a call is `select` over all of `...`, with the `Vararg` loading
+// them right before it, so the two can be done together without the copy
+pub fn is_vararg_select(code: &[Inst], call: Inst, value_list: &[Value]) -> bool {
+	let (vararg, before) = match code.split_last() {
+		Some((&vararg, before)) => (vararg, before),
+		None => return false,
+	};
+
+	vararg.opcode() == Opcode::Vararg
+		&& vararg.a() == call.a() + 2
+		&& vararg.c() == 0
+		&& call.b() == 0
+		&& find_intrinsic(before, call, value_list) == Some("luaA_select")
+}
+
+// the helpers the calls of a function may be done with, going by the same
+// guesses as when it is written, so only those have to be defined
+pub fn helper_list(proto: &Proto) -> Vec<&'static str> {
+	let mut list = Vec::new();
+
+	for blk in &proto.block_list {
+		for (i, &inst) in blk.code.iter().enumerate() {
+			let before = &blk.code[..i];
+
+			if let Some(name) = find_intrinsic(before, inst, &proto.value_list) {
+				list.push(name);
+			}
+
+			if is_vararg_select(before, inst, &proto.value_list) {
+				list.push("luaA_vararg_select");
+			}
+		}
+	}
+
+	list
+}
@@ -1,2 +1,10 @@
 mod baked;
+pub mod cache;
+mod concat;
 pub mod gen;
+mod infer;
+mod inline;
+mod intrinsic;
+pub mod profile;
+mod tail;
+mod unboxed;
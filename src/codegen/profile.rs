@@ -0,0 +1,108 @@
+use std::collections::HashMap;
+
+// a block is cold when it ran less than once per this many runs
+// of the busiest block leading into it
+const COLD_RATIO: u64 = 100;
+
+// what a report says of one function, where the source, line and number
+// of blocks tell whether it is still the function with that number
+#[derive(Default)]
+struct Record {
+	source: String,
+	line_defined: u32,
+	num_block: usize,
+	count_list: Vec<u64>,
+}
+
+// block counts recorded by a `--profile` build, read back from the `blocks`
+// and `block` rows of its report, which are `blocks,function,"source",line,
+// number of blocks` and `block,function,"source",block,count`
+#[derive(Default)]
+pub struct Profile {
+	record_map: HashMap<usize, Record>,
+}
+
+impl Profile {
+	pub fn parse(data: &str) -> Self {
+		let mut record_map: HashMap<usize, Record> = HashMap::new();
+
+		for row in data.lines() {
+			let mut head = row.splitn(3, ',');
+			let kind = head.next();
+
+			if kind != Some("blocks") && kind != Some("block") {
+				continue;
+			}
+
+			// the source may have commas of its own, so the rest is read from the end
+			let func = head.next().and_then(|v| v.parse().ok());
+			let mut tail = head.next().unwrap_or_default().rsplitn(3, ',');
+			let count = tail.next().and_then(|v| v.parse().ok());
+			let index = tail.next().and_then(|v| v.parse().ok());
+			let source = tail
+				.next()
+				.and_then(|v| v.strip_prefix('"'))
+				.and_then(|v| v.strip_suffix('"'));
+
+			let (func, index, count, source) = match (func, index, count, source) {
+				(Some(func), Some(index), Some(count), Some(source)) => {
+					(func, index, count, source)
+				}
+				_ => continue,
+			};
+
+			let record = record_map.entry(func).or_default();
+
+			if kind == Some("blocks") {
+				record.source = source.to_string();
+				record.line_defined = index as u32;
+				record.num_block = count as usize;
+			} else {
+				if record.count_list.len() <= index {
+					record.count_list.resize(index + 1, 0);
+				}
+
+				record.count_list[index] = count;
+			}
+		}
+
+		Self { record_map }
+	}
+
+	// the counts of every block of a function, or `None` if it was not seen
+	// or the report was taken of a different function under its number
+	pub fn count_list(
+		&self,
+		func: usize,
+		source: &[u8],
+		line_defined: u32,
+		len: usize,
+	) -> Option<Vec<u64>> {
+		let record = self.record_map.get(&func)?;
+
+		if record.source.as_bytes() != source
+			|| record.line_defined != line_defined
+			|| record.num_block != len
+			|| record.count_list.len() > len
+		{
+			return None;
+		}
+
+		let mut list = record.count_list.clone();
+
+		list.resize(len, 0);
+		Some(list)
+	}
+}
+
+// whether a block ran rarely compared to what leads into it, so
+// the compiler should keep it out of the way of the hot path
+pub fn is_cold(count_list: &[u64], pred_list: &[u32], block: usize) -> bool {
+	let busiest = pred_list
+		.iter()
+		.map(|&v| count_list[v as usize])
+		.max()
+		.unwrap_or(count_list[block]);
+
+	count_list[block] == 0 || count_list[block].saturating_mul(COLD_RATIO) < busiest
+}
@@ -0,0 +1,79 @@
+use crate::{
+	codegen::intrinsic::find_load,
+	common::types::{Inst, Opcode, Proto, Value},
+};
+
+// the names a function can call itself by, as found where its parent made
+// it; these are only guesses, checked against the callee when it is called
+#[derive(Clone, Copy, Default, Hash)]
+pub struct SelfRef<'a> {
+	upval: Option<u32>,
+	global: Option<&'a [u8]>,
+}
+
+// the upvalue a child captures the register its closure was put in with, and
+// the global its parent stores it in right after making it
+pub fn find_self_ref<'a>(parent: &Proto<'a>, child: usize) -> SelfRef<'a> {
+	let code: Vec<Inst> = parent
+		.block_list
+		.iter()
+		.flat_map(|v| v.code.iter().copied())
+		.collect();
+
+	let pc = match code
+		.iter()
+		.position(|v| v.opcode() == Opcode::Closure && v.bx() as usize == child)
+	{
+		Some(pc) => pc,
+		None => return SelfRef::default(),
+	};
+
+	let reg = code[pc].a();
+	let upval = parent.child_list[child]
+		.upval_list
+		.iter()
+		.position(|v| v.in_stack && u32::from(v.index) == reg)
+		.map(|v| v as u32);
+
+	let global = code
+		.get(pc + 1)
+		.filter(|v| v.opcode() == Opcode::SetTabUp && !v.k() && v.c() == reg)
+		.and_then(|v| match parent.value_list.get(v.b() as usize) {
+			Some(Value::String(name)) => Some(*name),
+			_ => None,
+		});
+
+	SelfRef { upval, global }
+}
+
+// whether a function can jump back to its start for a tail call to itself,
+// which needs the same parameters every time and nothing else to come in
+pub fn can_loop(proto: &Proto) -> bool {
+	proto.is_vararg == 0
+		&& proto
+			.block_list
+			.first()
+			.map_or(false, |v| v.pred_list.is_empty())
+}
+
+// whether a tail call looks to be to the function making it, going by how
+// the instructions of its block before it loaded the callee
+pub fn is_self_call(code: &[Inst], call: Inst, self_ref: SelfRef, value_list: &[Value]) -> bool {
+	if call.opcode() != Opcode::TailCall {
+		return false;
+	}
+
+	let load = match find_load(code, call.a()) {
+		Some((_, load)) => load,
+		None => return false,
+	};
+
+	match load.opcode() {
+		Opcode::GetUpval => self_ref.upval == Some(load.b()),
+		Opcode::GetTabUp => match value_list.get(load.c() as usize) {
+			Some(Value::String(name)) => self_ref.global == Some(*name),
+			_ => false,
+		},
+		_ => false,
+	}
+}
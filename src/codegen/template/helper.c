@@ -1,55 +1,3 @@
-#define lua_c
-#define LUA_CORE
-
-#include "lprefix.h"
-
-#include <float.h>
-#include <math.h>
-#include <stdlib.h>
-#include <string.h>
-
-#include "lua.h"
-
-#include "lauxlib.h"
-#include "ldebug.h"
-#include "lfunc.h"
-#include "lgc.h"
-#include "lobject.h"
-#include "lopcodes.h"
-#include "ltable.h"
-#include "lualib.h"
-#include "lvm.h"
-
-/*
-** 'l_intfitsf' checks whether a given integer is in the range that
-** can be converted to a float without rounding. Used in comparisons.
-*/
-
-/* number of bits in the mantissa of a float */
-#define NBM (l_floatatt(MANT_DIG))
-
-/*
-** Check whether some integers may not fit in a float, testing whether
-** (maxinteger >> NBM) > 0. (That implies (1 << NBM) <= maxinteger.)
-** (The shifts are done in parts, to avoid shifting by more than the size
-** of an integer. In a worst case, NBM == 113 for long double and
-** sizeof(long) == 32.)
-*/
-#if ((((LUA_MAXINTEGER >> (NBM / 4)) >> (NBM / 4)) >> (NBM / 4)) >>            \
-     (NBM - (3 * (NBM / 4)))) > 0
-
-/* limit for integers that fit in a float */
-#define MAXINTFITSF ((lua_Unsigned)1 << NBM)
-
-/* check whether 'i' is in the interval [-MAXINTFITSF, MAXINTFITSF] */
-#define l_intfitsf(i) ((MAXINTFITSF + l_castS2U(i)) <= (2 * MAXINTFITSF))
-
-#else /* all integers fit in a float precisely */
-
-#define l_intfitsf(i) 1
-
-#endif
-
 /*
 ** Compare two strings 'ls' x 'rs', returning an integer less-equal-
 ** -greater than zero if 'ls' is less-equal-greater than 'rs'.
@@ -82,121 +30,10 @@ static int l_strcmp(const TString *ls, const TString *rs) {
   }
 }
 
-/*
-** Check whether integer 'i' is less than float 'f'. If 'i' has an
-** exact representation as a float ('l_intfitsf'), compare numbers as
-** floats. Otherwise, use the equivalence 'i < f <=> i < ceil(f)'.
-** If 'ceil(f)' is out of integer range, either 'f' is greater than
-** all integers or less than all integers.
-** (The test with 'l_intfitsf' is only for performance; the else
-** case is correct for all values, but it is slow due to the conversion
-** from float to int.)
-** When 'f' is NaN, comparisons must result in false.
-*/
-static int LTintfloat(lua_Integer i, lua_Number f) {
-  if (l_intfitsf(i))
-    return luai_numlt(cast_num(i), f); /* compare them as floats */
-  else {                               /* i < f <=> i < ceil(f) */
-    lua_Integer fi;
-    if (luaV_flttointeger(f, &fi, F2Iceil)) /* fi = ceil(f) */
-      return i < fi;                        /* compare them as integers */
-    else            /* 'f' is either greater or less than all integers */
-      return f > 0; /* greater? */
-  }
-}
-
-/*
-** Check whether integer 'i' is less than or equal to float 'f'.
-** See comments on previous function.
-*/
-static int LEintfloat(lua_Integer i, lua_Number f) {
-  if (l_intfitsf(i))
-    return luai_numle(cast_num(i), f); /* compare them as floats */
-  else {                               /* i <= f <=> i <= floor(f) */
-    lua_Integer fi;
-    if (luaV_flttointeger(f, &fi, F2Ifloor)) /* fi = floor(f) */
-      return i <= fi;                        /* compare them as integers */
-    else            /* 'f' is either greater or less than all integers */
-      return f > 0; /* greater? */
-  }
-}
-
-/*
-** Check whether float 'f' is less than integer 'i'.
-** See comments on previous function.
-*/
-static int LTfloatint(lua_Number f, lua_Integer i) {
-  if (l_intfitsf(i))
-    return luai_numlt(f, cast_num(i)); /* compare them as floats */
-  else {                               /* f < i <=> floor(f) < i */
-    lua_Integer fi;
-    if (luaV_flttointeger(f, &fi, F2Ifloor)) /* fi = floor(f) */
-      return fi < i;                         /* compare them as integers */
-    else            /* 'f' is either greater or less than all integers */
-      return f < 0; /* less? */
-  }
-}
-
-/*
-** Check whether float 'f' is less than or equal to integer 'i'.
-** See comments on previous function.
-*/
-static int LEfloatint(lua_Number f, lua_Integer i) {
-  if (l_intfitsf(i))
-    return luai_numle(f, cast_num(i)); /* compare them as floats */
-  else {                               /* f <= i <=> ceil(f) <= i */
-    lua_Integer fi;
-    if (luaV_flttointeger(f, &fi, F2Iceil)) /* fi = ceil(f) */
-      return fi <= i;                       /* compare them as integers */
-    else            /* 'f' is either greater or less than all integers */
-      return f < 0; /* less? */
-  }
-}
-
-/*
-** Return 'l < r', for numbers.
-*/
-static int LTnum(const TValue *l, const TValue *r) {
-  lua_assert(ttisnumber(l) && ttisnumber(r));
-  if (ttisinteger(l)) {
-    lua_Integer li = ivalue(l);
-    if (ttisinteger(r))
-      return li < ivalue(r);              /* both are integers */
-    else                                  /* 'l' is int and 'r' is float */
-      return LTintfloat(li, fltvalue(r)); /* l < r ? */
-  } else {
-    lua_Number lf = fltvalue(l); /* 'l' must be float */
-    if (ttisfloat(r))
-      return luai_numlt(lf, fltvalue(r)); /* both are float */
-    else                                  /* 'l' is float and 'r' is int */
-      return LTfloatint(lf, ivalue(r));
-  }
-}
-
-/*
-** Return 'l <= r', for numbers.
-*/
-static int LEnum(const TValue *l, const TValue *r) {
-  lua_assert(ttisnumber(l) && ttisnumber(r));
-  if (ttisinteger(l)) {
-    lua_Integer li = ivalue(l);
-    if (ttisinteger(r))
-      return li <= ivalue(r);             /* both are integers */
-    else                                  /* 'l' is int and 'r' is float */
-      return LEintfloat(li, fltvalue(r)); /* l <= r ? */
-  } else {
-    lua_Number lf = fltvalue(l); /* 'l' must be float */
-    if (ttisfloat(r))
-      return luai_numle(lf, fltvalue(r)); /* both are float */
-    else                                  /* 'l' is float and 'r' is int */
-      return LEfloatint(lf, ivalue(r));
-  }
-}
-
 /*
 ** return 'l < r' for non-numbers.
 */
-static int lessthanothers(lua_State *L, const TValue *l, const TValue *r) {
+int lessthanothers(lua_State *L, const TValue *l, const TValue *r) {
   lua_assert(!ttisnumber(l) || !ttisnumber(r));
   if (ttisstring(l) && ttisstring(r)) /* both are strings? */
     return l_strcmp(tsvalue(l), tsvalue(r)) < 0;
@@ -207,7 +44,7 @@ static int lessthanothers(lua_State *L, const TValue *l, const TValue *r) {
 /*
 ** return 'l <= r' for non-numbers.
 */
-static int lessequalothers(lua_State *L, const TValue *l, const TValue *r) {
+int lessequalothers(lua_State *L, const TValue *l, const TValue *r) {
   lua_assert(!ttisnumber(l) || !ttisnumber(r));
   if (ttisstring(l) && ttisstring(r)) /* both are strings? */
     return l_strcmp(tsvalue(l), tsvalue(r)) <= 0;
@@ -261,7 +98,7 @@ static int forlimit(lua_State *L, lua_Integer init, const TValue *lim,
 **   ra + 2 : step
 **   ra + 3 : control variable
 */
-static int forprep(lua_State *L, StkId ra) {
+int forprep(lua_State *L, StkId ra) {
   TValue *pinit = s2v(ra);
   TValue *plimit = s2v(ra + 1);
   TValue *pstep = s2v(ra + 2);
@@ -314,102 +151,81 @@ static int forprep(lua_State *L, StkId ra) {
   return 0;
 }
 
-/*
-** Execute a step of a float numerical for loop, returning
-** true iff the loop must continue. (The integer case is
-** written online with opcode OP_FORLOOP, for performance.)
-*/
-static int iter_number(StkId ra) {
-  lua_Number step = fltvalue(s2v(ra + 2));
-  lua_Number limit = fltvalue(s2v(ra + 1));
-  lua_Number idx = fltvalue(s2v(ra)); /* internal index */
-  idx = luai_numadd(L, idx, step);    /* increment index */
-  if (luai_numlt(0, step) ? luai_numle(idx, limit) : luai_numle(limit, idx)) {
-    chgfltvalue(s2v(ra), idx);     /* update internal index */
-    setfltvalue(s2v(ra + 3), idx); /* and control variable */
-    return 1;                      /* jump back */
-  }
-  return 0;
+// raised when a slot of a transpiled closure no longer holds what it was
+// made with
+GCObject *luaA_slot_error(lua_State *L) {
+  luaG_runerror(L, "upvalues of a transpiled function were changed");
+  return NULL;
 }
 
-static int iter_integer(StkId ra) {
-  lua_Unsigned count = l_castS2U(ivalue(s2v(ra + 1)));
-  if (count > 0) {
-    lua_Integer step = ivalue(s2v(ra + 2));
-    lua_Integer idx = ivalue(s2v(ra));
-    chgivalue(s2v(ra + 1), count - 1);
-    idx = intop(+, idx, step);
-    chgivalue(s2v(ra), idx);
-    setivalue(s2v(ra + 3), idx);
-    return 1;
-  }
-  return 0;
+static void lua_set_object(TValue *io, GCObject *o) {
+  val_(io).gc = o;
+  settt_(io, ctb(o->tt));
 }
 
-/*
-** Shift left operation. (Shift right just negates 'y'.)
-*/
-#define luaV_shiftr(x, y) luaV_shiftl(x, -(y))
+static CClosure *lua_new_closure(lua_State *L, Proto *p, lua_CFunction native) {
+  int nup = p->sizeupvalues;
+  CClosure *ncl;
+
+  lua_assert(nup < MAXUPVAL); /* the prototype takes the extra slot */
+  ncl = luaF_newCclosure(L, nup + 1);
+
+  ncl->f = native;
+  lua_set_object(&ncl->upvalue[0], obj2gco(p));
+
+  /* the upvalues are created after, so a collection must not see garbage */
+  for (int i = 1; i <= nup; i++)
+    setnilvalue(&ncl->upvalue[i]);
+
+  return ncl;
+}
 
 /*
-** create a new Lua closure, push it in the stack, and initialize
+** create a new closure, push it in the stack, and initialize
 ** its upvalues.
 */
-static void pushclosure(lua_State *L, Proto *p, UpVal **encup, StkId base,
-                        StkId ra) {
+void pushclosure(lua_State *L, Proto *p, CClosure *encl, StkId base, StkId ra,
+                 lua_CFunction native) {
   int nup = p->sizeupvalues;
   Upvaldesc *uv = p->upvalues;
   int i;
-  LClosure *ncl = luaF_newLclosure(L, nup);
-  ncl->p = p;
-  setclLvalue2s(L, ra, ncl);  /* anchor new closure in stack */
-  for (i = 0; i < nup; i++) { /* fill in its upvalues */
-    if (uv[i].instack)        /* upvalue refers to local variable? */
-      ncl->upvals[i] = luaF_findupval(L, base + uv[i].idx);
+  CClosure *ncl = lua_new_closure(L, p, native);
+  setclCvalue(L, s2v(ra), ncl); /* anchor new closure in stack */
+  for (i = 0; i < nup; i++) {   /* fill in its upvalues */
+    UpVal *up;
+    if (uv[i].instack) /* upvalue refers to local variable? */
+      up = luaF_findupval(L, base + uv[i].idx);
     else /* get upvalue from enclosing function */
-      ncl->upvals[i] = encup[uv[i].idx];
-    luaC_objbarrier(L, ncl, ncl->upvals[i]);
+      up = lua_get_upval(encl, uv[i].idx);
+    lua_set_object(&ncl->upvalue[i + 1], obj2gco(up));
+    luaC_objbarrier(L, ncl, up);
   }
 }
 
-/*
-** {==================================================================
-** Macros for arithmetic/bitwise/comparison opcodes in 'luaV_execute'
-** ===================================================================
-*/
-
-#define l_addi(L, a, b) intop(+, a, b)
-#define l_subi(L, a, b) intop(-, a, b)
-#define l_muli(L, a, b) intop(*, a, b)
-#define l_band(a, b) intop(&, a, b)
-#define l_bor(a, b) intop(|, a, b)
-#define l_bxor(a, b) intop(^, a, b)
+// prototypes without upvalues always make equal closures, so one is made
+// the first time and kept in the registry under the prototype after that
+void pushsharedclosure(lua_State *L, Proto *p, StkId ra, lua_CFunction native) {
+  L->top = ra + 1;
+  lua_rawgetp(L, LUA_REGISTRYINDEX, p);
 
-#define l_lti(a, b) (a < b)
-#define l_lei(a, b) (a <= b)
-#define l_gti(a, b) (a > b)
-#define l_gei(a, b) (a >= b)
-
-#define FK(o) (ttisnil(ct_k + o) ? rt_k[o] : ct_k[o])
-#define RA(i) (base + GETARG_A(i))
-#define RB(i) (base + GETARG_B(i))
-#define vRB(i) s2v(RB(i))
-#define KB(i) FK(GETARG_B(i))
-#define RC(i) (base + GETARG_C(i))
-#define vRC(i) s2v(RC(i))
-#define KC(i) FK(GETARG_C(i))
-#define RKC(i) ((TESTARG_k(i)) ? KC(i) : *s2v(RC(i)))
-
-LClosure *lua_get_l_closure(CallInfo *ci) {
-  TValue func = clCvalue(s2v(ci->func))->upvalue[0];
-
-  return clLvalue(&func);
+  if (ttisnil(s2v(L->top - 1))) {
+    setclCvalue(L, s2v(ra), lua_new_closure(L, p, native));
+    setobjs2s(L, L->top - 1, ra);
+    lua_rawsetp(L, LUA_REGISTRYINDEX, p);
+  } else {
+    setobjs2s(L, ra, L->top - 1);
+    L->top--;
+  }
 }
 
-// custom adjustment for C functions
+// custom adjustment for C functions, where a call without extra arguments
+// already has the frame it needs and is left as it is
 void luaA_set_varargs(lua_State *L, CallInfo *ci, int param, int stack) {
   int actual = cast_int(L->top - ci->func) - 1;
 
+  if (actual <= param)
+    return;
+
   luaD_checkstack(L, stack + 1);
   setobjs2s(L, L->top++, ci->func);
 
@@ -450,15 +266,648 @@ void luaA_pretailcall(lua_State *L, CallInfo *ci, StkId func, int args) {
   L->top = ci->top;
 }
 
+// custom end of a tail call, which leaves its results at the frame's start
+int luaA_posttailcall(lua_State *L, CallInfo *ci) {
+  int n = cast_int(L->top - ci->func);
+
+  luaD_poscall(L, ci, n);
+
+  return n;
+}
+
 // custom function wrapping for Lua functions
 void luaA_wrap_closure(lua_State *L, StkId dummy, lua_CFunction native) {
   lua_lock(L);
-  CClosure *cl = luaF_newCclosure(L, 1);
+  LClosure *lcl = clLvalue(s2v(dummy));
+  CClosure *cl = lua_new_closure(L, lcl->p, native);
+
+  for (int i = 0; i < lcl->nupvalues; i++) {
+    lua_set_object(&cl->upvalue[i + 1], obj2gco(lcl->upvals[i]));
+  }
 
-  cl->f = native;
-  setobj2n(L, &cl->upvalue[0], s2v(dummy));
   setclCvalue(L, s2v(dummy), cl);
 
   luaC_checkGC(L);
   lua_unlock(L);
 }
+
+// fills in a prototype reachable by the collector, the same way
+// 'lundump.c' does, with `str` holding the interned strings
+static void luaA_load_proto(lua_State *L, Proto *f, LeanProto const *lp,
+                            TValue const *str) {
+  f->numparams = lp->numparams;
+  f->is_vararg = lp->is_vararg;
+  f->maxstacksize = lp->maxstacksize;
+
+  f->k = luaM_newvectorchecked(L, lp->sizek, TValue);
+  f->sizek = lp->sizek;
+
+  for (int i = 0; i < lp->sizek; i++)
+    setnilvalue(&f->k[i]);
+
+  for (int i = 0; i < lp->sizek; i++) {
+    LeanConstant const *c = &lp->k[i];
+    TValue *o = &f->k[i];
+
+    switch (c->tt) {
+    case LUA_VFALSE:
+      setbfvalue(o);
+      break;
+    case LUA_VTRUE:
+      setbtvalue(o);
+      break;
+    case LUA_VNUMINT:
+      setivalue(o, c->u.i);
+      break;
+    case LUA_VNUMFLT:
+      setfltvalue(o, c->u.n);
+      break;
+    case LUA_VSHRSTR:
+    case LUA_VLNGSTR:
+      setobj(L, o, &str[c->u.s]);
+      luaC_barrier(L, f, o);
+      break;
+    }
+  }
+
+  f->upvalues = luaM_newvectorchecked(L, lp->sizeupvalues, Upvaldesc);
+  f->sizeupvalues = lp->sizeupvalues;
+
+  for (int i = 0; i < lp->sizeupvalues; i++)
+    f->upvalues[i] = lp->upvalues[i];
+
+  f->p = luaM_newvectorchecked(L, lp->sizep, Proto *);
+  f->sizep = lp->sizep;
+
+  for (int i = 0; i < lp->sizep; i++)
+    f->p[i] = NULL;
+
+  for (int i = 0; i < lp->sizep; i++) {
+    f->p[i] = luaF_newproto(L);
+    luaC_objbarrier(L, f, f->p[i]);
+    luaA_load_proto(L, f->p[i], lp->p[i], str);
+  }
+}
+
+// custom function loading that builds the prototypes from static data
+// instead of undumping them, interning all of their strings up front
+void luaA_push_static(lua_State *L, LeanProto const *lp, LeanString const *str,
+                      int nstr, lua_CFunction native) {
+  lua_createtable(L, nstr, 0);
+
+  for (int i = 0; i < nstr; i++) {
+    lua_pushlstring(L, str[i].data, str[i].size);
+    lua_rawseti(L, -2, i + 1);
+  }
+
+  lua_lock(L);
+  Proto *p = luaF_newproto(L);
+
+  /* keep the prototype alive while it is built */
+  lua_set_object(s2v(L->top), obj2gco(p));
+  L->top++;
+
+  luaA_load_proto(L, p, lp, hvalue(s2v(L->top - 2))->array);
+
+  CClosure *cl = lua_new_closure(L, p, native);
+
+  setclCvalue(L, s2v(L->top - 2), cl);
+  L->top--;
+
+  for (int i = 0; i < p->sizeupvalues; i++) {
+    UpVal *uv = gco2upv(luaC_newobj(L, LUA_VUPVAL, sizeof(UpVal)));
+
+    uv->v = &uv->u.value;
+    setnilvalue(uv->v);
+    lua_set_object(&cl->upvalue[i + 1], obj2gco(uv));
+    luaC_objbarrier(L, cl, uv);
+  }
+
+  /* the first upvalue of a main function is the globals */
+  if (p->sizeupvalues >= 1) {
+    UpVal *uv = lua_get_upval(cl, 0);
+    TValue const *gt = &hvalue(&G(L)->l_registry)->array[LUA_RIDX_GLOBALS - 1];
+
+    setobj(L, uv->v, gt);
+    luaC_barrier(L, uv, gt);
+  }
+
+  luaC_checkGC(L);
+  lua_unlock(L);
+}
+
+// the number of arguments of a call, which may run up to the top
+static inline int luaA_num_arg(lua_State *L, StkId ra, Instruction i) {
+  int b = GETARG_B(i);
+
+  return b != 0 ? b - 1 : cast_int(L->top - ra) - 1;
+}
+
+// leaves `n` results at `ra` the way the call asked for them
+static inline int luaA_set_results(lua_State *L, StkId ra, int n,
+                                   Instruction i) {
+  int c = GETARG_C(i);
+
+  if (c == 0) {
+    L->top = ra + n;
+    return 1;
+  }
+
+  for (; n < c - 1; n++)
+    setnilvalue(s2v(ra + n));
+
+  L->top = ra + c - 1;
+  return 1;
+}
+
+// string positions as 'lstrlib.c' makes them relative to the length
+static inline size_t luaA_posrelat(lua_Integer pos, size_t len) {
+  if (pos > 0)
+    return (size_t)pos;
+  else if (pos == 0)
+    return 1;
+  else if (pos < -(lua_Integer)len)
+    return 1;
+  else
+    return len + (size_t)pos + 1;
+}
+
+static inline size_t luaA_endpos(lua_Integer pos, size_t len) {
+  if (pos > (lua_Integer)len)
+    return len;
+  else if (pos >= 0)
+    return (size_t)pos;
+  else if (pos < -(lua_Integer)len)
+    return 0;
+  else
+    return len + (size_t)pos + 1;
+}
+
+// the helpers below are only defined for the library functions that some
+// call may be done inline for, which have `LEAN_HAS_` and their name defined
+#ifdef LEAN_HAS_IPAIRS
+int luaA_ipairs(lua_State *L, StkId ra, Instruction i) {
+  if (!lua_is_builtin(L, s2v(ra), LEAN_IPAIRS) || luaA_num_arg(L, ra, i) < 1)
+    return 0;
+
+  setfvalue(s2v(ra), lua_builtin_list[LEAN_IPAIRS_AUX]);
+  setivalue(s2v(ra + 2), 0);
+  return luaA_set_results(L, ra, 3, i);
+}
+#endif
+
+#ifdef LEAN_HAS_PAIRS
+// tables with a metatable may have `__pairs`, which is left to the call
+int luaA_pairs(lua_State *L, StkId ra, Instruction i) {
+  TValue *t = s2v(ra + 1);
+
+  if (!lua_is_builtin(L, s2v(ra), LEAN_PAIRS) || luaA_num_arg(L, ra, i) < 1 ||
+      !ttistable(t) || hvalue(t)->metatable != NULL)
+    return 0;
+
+  setfvalue(s2v(ra), lua_builtin_list[LEAN_NEXT]);
+  setnilvalue(s2v(ra + 2));
+  return luaA_set_results(L, ra, 3, i);
+}
+#endif
+
+#ifdef LEAN_HAS_RAWGET
+int luaA_rawget(lua_State *L, StkId ra, Instruction i) {
+  TValue *t = s2v(ra + 1);
+
+  if (!lua_is_builtin(L, s2v(ra), LEAN_RAWGET) || luaA_num_arg(L, ra, i) < 2 ||
+      !ttistable(t))
+    return 0;
+
+  const TValue *slot = luaH_get(hvalue(t), s2v(ra + 2));
+
+  if (isempty(slot))
+    setnilvalue(s2v(ra));
+  else
+    setobj2s(L, ra, slot);
+
+  return luaA_set_results(L, ra, 1, i);
+}
+#endif
+
+#ifdef LEAN_HAS_SELECT
+// both `select('#', ...)` and `select(n, ...)` with an index in range
+int luaA_select(lua_State *L, StkId ra, Instruction i) {
+  TValue *v = s2v(ra + 1);
+  int n = luaA_num_arg(L, ra, i);
+
+  if (!lua_is_builtin(L, s2v(ra), LEAN_SELECT) || n < 1)
+    return 0;
+
+  if (ttisstring(v) && tsslen(tsvalue(v)) == 1 && *svalue(v) == '#') {
+    setivalue(s2v(ra), n - 1);
+    return luaA_set_results(L, ra, 1, i);
+  }
+
+  if (!ttisinteger(v))
+    return 0;
+
+  lua_Integer k = ivalue(v);
+
+  if (k < 0)
+    k = n + k;
+  else if (k > n)
+    k = n;
+
+  if (k < 1)
+    return 0;
+
+  for (int j = 0; j < n - k; j++)
+    setobjs2s(L, ra + j, ra + 1 + k + j);
+
+  return luaA_set_results(L, ra, n - cast_int(k), i);
+}
+#endif
+
+#ifdef LEAN_HAS_TYPE
+int luaA_type(lua_State *L, StkId ra, Instruction i) {
+  if (!lua_is_builtin(L, s2v(ra), LEAN_TYPE) || luaA_num_arg(L, ra, i) < 1)
+    return 0;
+
+  TString *name = luaS_new(L, ttypename(ttype(s2v(ra + 1))));
+
+  setsvalue2s(L, ra, name);
+  return luaA_set_results(L, ra, 1, i);
+}
+#endif
+
+#ifdef LEAN_HAS_MATH_ABS
+int luaA_math_abs(lua_State *L, StkId ra, Instruction i) {
+  TValue *v = s2v(ra + 1);
+
+  if (!lua_is_builtin(L, s2v(ra), LEAN_MATH_ABS) || luaA_num_arg(L, ra, i) < 1)
+    return 0;
+
+  if (ttisinteger(v)) {
+    lua_Integer n = ivalue(v);
+
+    setivalue(s2v(ra), n < 0 ? l_castU2S(0u - l_castS2U(n)) : n);
+  } else if (ttisfloat(v)) {
+    setfltvalue(s2v(ra), l_mathop(fabs)(fltvalue(v)));
+  } else {
+    return 0;
+  }
+
+  return luaA_set_results(L, ra, 1, i);
+}
+#endif
+
+#ifdef LEAN_HAS_MATH_FLOOR
+int luaA_math_floor(lua_State *L, StkId ra, Instruction i) {
+  TValue *v = s2v(ra + 1);
+
+  if (!lua_is_builtin(L, s2v(ra), LEAN_MATH_FLOOR) ||
+      luaA_num_arg(L, ra, i) < 1)
+    return 0;
+
+  if (ttisinteger(v)) {
+    setobjs2s(L, ra, ra + 1);
+  } else if (ttisfloat(v)) {
+    lua_Number d = l_mathop(floor)(fltvalue(v));
+    lua_Integer n;
+
+    if (lua_numbertointeger(d, &n))
+      setivalue(s2v(ra), n);
+    else
+      setfltvalue(s2v(ra), d);
+  } else {
+    return 0;
+  }
+
+  return luaA_set_results(L, ra, 1, i);
+}
+#endif
+
+#ifdef LEAN_HAS_VARARG_SELECT
+// `select` over the varargs of the function, read from where they are
+// instead of being copied up to the call with the rest of its arguments
+int luaA_vararg_select(lua_State *L, CallInfo *ci, StkId ra, Instruction i,
+                       int n_vararg) {
+  TValue *v = s2v(ra + 1);
+  int const n = n_vararg + 1;
+
+  if (!lua_is_builtin(L, s2v(ra), LEAN_SELECT))
+    return 0;
+
+  if (ttisstring(v) && tsslen(tsvalue(v)) == 1 && *svalue(v) == '#') {
+    setivalue(s2v(ra), n_vararg);
+    return luaA_set_results(L, ra, 1, i);
+  }
+
+  if (!ttisinteger(v))
+    return 0;
+
+  lua_Integer k = ivalue(v);
+
+  if (k < 0)
+    k = n + k;
+  else if (k > n)
+    k = n;
+
+  if (k < 1)
+    return 0;
+
+  int c = GETARG_C(i);
+  int num = n - cast_int(k);
+
+  if (c == 0)
+    checkstackGCp(L, num, ra);
+  else if (num > c - 1)
+    num = c - 1;
+
+  for (int j = 0; j < num; j++)
+    setobjs2s(L, ra + j, ci->func - n_vararg + cast_int(k) - 1 + j);
+
+  return luaA_set_results(L, ra, num, i);
+}
+#endif
+
+#ifdef LEAN_HAS_STRING_BYTE
+// only the forms giving at most one byte, `s:byte()` and `s:byte(i)`
+int luaA_string_byte(lua_State *L, StkId ra, Instruction i) {
+  TValue *s = s2v(ra + 1);
+  int n = luaA_num_arg(L, ra, i);
+
+  if (!lua_is_builtin(L, s2v(ra), LEAN_STRING_BYTE) || n < 1 || n > 2 ||
+      !ttisstring(s) || (n == 2 && !ttisinteger(s2v(ra + 2))))
+    return 0;
+
+  lua_Integer at = n == 2 ? ivalue(s2v(ra + 2)) : 1;
+  size_t len = tsslen(tsvalue(s));
+  size_t pos = luaA_posrelat(at, len);
+
+  if (pos > luaA_endpos(at, len))
+    return luaA_set_results(L, ra, 0, i);
+
+  setivalue(s2v(ra), cast_uchar(svalue(s)[pos - 1]));
+  return luaA_set_results(L, ra, 1, i);
+}
+#endif
+
+#ifdef LEAN_HAS_STRING_SUB
+int luaA_string_sub(lua_State *L, StkId ra, Instruction i) {
+  TValue *s = s2v(ra + 1);
+  int n = luaA_num_arg(L, ra, i);
+
+  if (!lua_is_builtin(L, s2v(ra), LEAN_STRING_SUB) || n < 2 || n > 3 ||
+      !ttisstring(s) || !ttisinteger(s2v(ra + 2)) ||
+      (n == 3 && !ttisinteger(s2v(ra + 3))))
+    return 0;
+
+  size_t len = tsslen(tsvalue(s));
+  size_t start = luaA_posrelat(ivalue(s2v(ra + 2)), len);
+  size_t end = luaA_endpos(n == 3 ? ivalue(s2v(ra + 3)) : -1, len);
+  TString *sub;
+
+  if (start > end)
+    sub = luaS_newlstr(L, "", 0);
+  else
+    sub = luaS_newlstr(L, svalue(s) + start - 1, end - start + 1);
+
+  setsvalue2s(L, ra, sub);
+  L->top = ra + 1;
+  luaC_checkGC(L);
+  return luaA_set_results(L, ra, 1, i);
+}
+#endif
+
+#ifdef LEAN_HAS_TABLE_INSERT
+// only the appending form, on tables without a metatable
+int luaA_table_insert(lua_State *L, StkId ra, Instruction i) {
+  TValue *t = s2v(ra + 1);
+
+  if (!lua_is_builtin(L, s2v(ra), LEAN_TABLE_INSERT) ||
+      luaA_num_arg(L, ra, i) != 2 || !ttistable(t) ||
+      hvalue(t)->metatable != NULL)
+    return 0;
+
+  Table *h = hvalue(t);
+  TValue *v = s2v(ra + 2);
+
+  luaH_setint(L, h, l_castU2S(luaH_getn(h)) + 1, v);
+  luaC_barrierback(L, obj2gco(h), v);
+  return luaA_set_results(L, ra, 0, i);
+}
+#endif
+
+// writes a number as 'luaO_tostring' does, without making a string of it
+static size_t luaA_number2str(TValue const *v, char *buff) {
+  int len;
+
+  if (ttisinteger(v))
+    return lua_integer2str(buff, LEAN_MAXNUMBER2STR, ivalue(v));
+
+  len = lua_number2str(buff, LEAN_MAXNUMBER2STR, fltvalue(v));
+
+  // looks like an integer, so it gets a '.0' to tell them apart
+  if (buff[strspn(buff, "-0123456789")] == '\0') {
+    buff[len++] = lua_getlocaledecpoint();
+    buff[len++] = '0';
+  }
+
+  return len;
+}
+
+// the total length of `n` operands from `from`, or `LEAN_CONCAT_NONE`
+// if any of them is not a string or a number or it would overflow
+static size_t luaA_concat_len(StkId from, int n, LeanNumList *num) {
+  size_t total = 0;
+
+  num->len = 0;
+
+  for (int j = 0; j < n; j++) {
+    TValue *v = s2v(from + j);
+    size_t len;
+
+    if (ttisstring(v)) {
+      len = tsslen(tsvalue(v));
+    } else if (!ttisnumber(v)) {
+      return LEAN_CONCAT_NONE;
+    } else if (num->len < LEAN_CONCAT_NUM) {
+      len = luaA_number2str(v, num->data[num->len]);
+      num->size[num->len++] = len;
+    } else {
+      char buff[LEAN_MAXNUMBER2STR];
+
+      len = luaA_number2str(v, buff);
+    }
+
+    if (len >= MAX_SIZE - total)
+      return LEAN_CONCAT_NONE;
+
+    total += len;
+  }
+
+  return total;
+}
+
+// copies the operands measured by 'luaA_concat_len' out to `buff`
+static void luaA_concat_copy(char *buff, StkId from, int n,
+                             LeanNumList const *num) {
+  int index = 0;
+
+  for (int j = 0; j < n; j++) {
+    TValue *v = s2v(from + j);
+
+    if (ttisstring(v)) {
+      size_t len = tsslen(tsvalue(v));
+
+      memcpy(buff, svalue(v), len * sizeof(char));
+      buff += len;
+    } else if (index < num->len) {
+      memcpy(buff, num->data[index], num->size[index] * sizeof(char));
+      buff += num->size[index++];
+    } else {
+      buff += luaA_number2str(v, buff);
+    }
+  }
+}
+
+// makes the part of a chain into the string on the stack it stands in for,
+// so the op it falls back on sees its operands as they would have been
+static void luaA_concat_flush(lua_State *L, StkId ra, LeanConcat *part) {
+  if (part != NULL && part->len != LEAN_CONCAT_NONE) {
+    setsvalue2s(L, ra, luaS_newlstr(L, part->data, part->len));
+    part->len = LEAN_CONCAT_NONE;
+  }
+}
+
+// adds `n` operands from `ra` to the part of a chain, starting it over
+// if `first` and skipping the first operand it stands in for otherwise,
+// or returns 0 if the op has to be done on the stack
+int luaA_concat_part(lua_State *L, StkId ra, int n, LeanConcat *part,
+                     int first) {
+  LeanNumList num;
+  StkId from = first ? ra : ra + 1;
+  int count = first ? n : n - 1;
+  size_t len;
+
+  if (first)
+    part->len = 0;
+  else if (part->len == LEAN_CONCAT_NONE)
+    return 0;
+
+  len = luaA_concat_len(from, count, &num);
+
+  if (len == LEAN_CONCAT_NONE || len > LEAN_CONCAT_PART - part->len) {
+    if (first)
+      part->len = LEAN_CONCAT_NONE;
+    else
+      luaA_concat_flush(L, ra, part);
+
+    return 0;
+  }
+
+  luaA_concat_copy(part->data + part->len, from, count, &num);
+  part->len += len;
+  return 1;
+}
+
+// concatenates `n` strings and numbers from `ra`, after the part of a chain
+// in place of the first one when there is one, into a result allocated
+// once; returns NULL if the op needs 'luaV_concat' and its metamethods
+TString *luaA_concat(lua_State *L, StkId ra, int n, LeanConcat *part) {
+  LeanNumList num;
+  int const has_part = part != NULL && part->len != LEAN_CONCAT_NONE;
+  size_t const head = has_part ? part->len : 0;
+  StkId from = has_part ? ra + 1 : ra;
+  int const count = has_part ? n - 1 : n;
+  size_t len = luaA_concat_len(from, count, &num);
+  TString *ts;
+
+  if (len == LEAN_CONCAT_NONE || len >= MAX_SIZE - head) {
+    luaA_concat_flush(L, ra, part);
+    return NULL;
+  }
+
+  len += head;
+
+  if (len <= LUAI_MAXSHORTLEN) {
+    char buff[LUAI_MAXSHORTLEN];
+
+    if (has_part)
+      memcpy(buff, part->data, head * sizeof(char));
+
+    luaA_concat_copy(buff + head, from, count, &num);
+    ts = luaS_newlstr(L, buff, len);
+  } else {
+    ts = luaS_createlngstrobj(L, len);
+
+    if (has_part)
+      memcpy(getstr(ts), part->data, head * sizeof(char));
+
+    luaA_concat_copy(getstr(ts) + head, from, count, &num);
+  }
+
+  return ts;
+}
+
+// the shared helpers of rarely run opcodes, each one only defined when some
+// function calls it, which has `LEAN_HAS_OUTLINE_` and its opcode defined
+#ifdef LEAN_HAS_OUTLINE_CLOSE
+LEAN_NOINLINE void luaA_outline_Close(lua_outline_frame, Instruction baked) {
+  Close(baked);
+}
+#endif
+
+#ifdef LEAN_HAS_OUTLINE_TBC
+LEAN_NOINLINE void luaA_outline_Tbc(lua_outline_frame, Instruction baked) {
+  Tbc(baked);
+}
+#endif
+
+#ifdef LEAN_HAS_OUTLINE_LEN
+LEAN_NOINLINE void luaA_outline_Len(lua_outline_frame, Instruction baked) {
+  Len(baked);
+}
+#endif
+
+#ifdef LEAN_HAS_OUTLINE_CONCAT
+LEAN_NOINLINE void luaA_outline_Concat(lua_outline_frame, Instruction baked) {
+  Concat(baked);
+}
+#endif
+
+#ifdef LEAN_HAS_OUTLINE_SETLIST
+LEAN_NOINLINE void luaA_outline_SetList(lua_outline_frame, Instruction baked,
+                                        int extra) {
+  SetList(baked, extra);
+}
+#endif
+
+#ifdef LEAN_HAS_OUTLINE_VARARG
+// the caller updates its own `base` after the stack may have grown
+LEAN_NOINLINE void luaA_outline_Vararg(lua_outline_frame, Instruction baked,
+                                       int n_vararg) {
+  Vararg(baked);
+}
+#endif
+
+#ifdef LEAN_HAS_OUTLINE_MMBIN
+// the metamethod fallbacks of arithmetic, where `i` is the instruction
+// that fell back to them
+LEAN_NOINLINE void luaA_outline_MmBin(lua_outline_frame, Instruction baked,
+                                      Instruction i) {
+  MmBin(baked);
+}
+#endif
+
+#ifdef LEAN_HAS_OUTLINE_MMBINI
+LEAN_NOINLINE void luaA_outline_MmBinI(lua_outline_frame, Instruction baked,
+                                       Instruction i) {
+  MmBinI(baked);
+}
+#endif
+
+#ifdef LEAN_HAS_OUTLINE_MMBINK
+LEAN_NOINLINE void luaA_outline_MmBinK(lua_outline_frame, Instruction baked,
+                                       Instruction i) {
+  TValue *const rt_k = lua_get_proto(cl)->k;
+  MmBinK(baked);
+}
+#endif
@@ -0,0 +1,555 @@
+#define lua_c
+#define LUA_CORE
+
+#include "lprefix.h"
+
+#include <float.h>
+#include <locale.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "lua.h"
+
+#include "lauxlib.h"
+#include "ldebug.h"
+#include "lfunc.h"
+#include "lgc.h"
+#include "lmem.h"
+#include "lobject.h"
+#include "lopcodes.h"
+#include "lstring.h"
+#include "ltable.h"
+#include "lualib.h"
+#include "lvm.h"
+
+/*
+** 'l_intfitsf' checks whether a given integer is in the range that
+** can be converted to a float without rounding. Used in comparisons.
+*/
+
+/* number of bits in the mantissa of a float */
+#define NBM (l_floatatt(MANT_DIG))
+
+/*
+** Check whether some integers may not fit in a float, testing whether
+** (maxinteger >> NBM) > 0. (That implies (1 << NBM) <= maxinteger.)
+** (The shifts are done in parts, to avoid shifting by more than the size
+** of an integer. In a worst case, NBM == 113 for long double and
+** sizeof(long) == 32.)
+*/
+#if ((((LUA_MAXINTEGER >> (NBM / 4)) >> (NBM / 4)) >> (NBM / 4)) >>            \
+     (NBM - (3 * (NBM / 4)))) > 0
+
+/* limit for integers that fit in a float */
+#define MAXINTFITSF ((lua_Unsigned)1 << NBM)
+
+/* check whether 'i' is in the interval [-MAXINTFITSF, MAXINTFITSF] */
+#define l_intfitsf(i) ((MAXINTFITSF + l_castS2U(i)) <= (2 * MAXINTFITSF))
+
+#else /* all integers fit in a float precisely */
+
+#define l_intfitsf(i) 1
+
+#endif
+
+/*
+** Check whether integer 'i' is less than float 'f'. If 'i' has an
+** exact representation as a float ('l_intfitsf'), compare numbers as
+** floats. Otherwise, use the equivalence 'i < f <=> i < ceil(f)'.
+** If 'ceil(f)' is out of integer range, either 'f' is greater than
+** all integers or less than all integers.
+** (The test with 'l_intfitsf' is only for performance; the else
+** case is correct for all values, but it is slow due to the conversion
+** from float to int.)
+** When 'f' is NaN, comparisons must result in false.
+*/
+static inline int LTintfloat(lua_Integer i, lua_Number f) {
+  if (l_intfitsf(i))
+    return luai_numlt(cast_num(i), f); /* compare them as floats */
+  else {                               /* i < f <=> i < ceil(f) */
+    lua_Integer fi;
+    if (luaV_flttointeger(f, &fi, F2Iceil)) /* fi = ceil(f) */
+      return i < fi;                        /* compare them as integers */
+    else            /* 'f' is either greater or less than all integers */
+      return f > 0; /* greater? */
+  }
+}
+
+/*
+** Check whether integer 'i' is less than or equal to float 'f'.
+** See comments on previous function.
+*/
+static inline int LEintfloat(lua_Integer i, lua_Number f) {
+  if (l_intfitsf(i))
+    return luai_numle(cast_num(i), f); /* compare them as floats */
+  else {                               /* i <= f <=> i <= floor(f) */
+    lua_Integer fi;
+    if (luaV_flttointeger(f, &fi, F2Ifloor)) /* fi = floor(f) */
+      return i <= fi;                        /* compare them as integers */
+    else            /* 'f' is either greater or less than all integers */
+      return f > 0; /* greater? */
+  }
+}
+
+/*
+** Check whether float 'f' is less than integer 'i'.
+** See comments on previous function.
+*/
+static inline int LTfloatint(lua_Number f, lua_Integer i) {
+  if (l_intfitsf(i))
+    return luai_numlt(f, cast_num(i)); /* compare them as floats */
+  else {                               /* f < i <=> floor(f) < i */
+    lua_Integer fi;
+    if (luaV_flttointeger(f, &fi, F2Ifloor)) /* fi = floor(f) */
+      return fi < i;                         /* compare them as integers */
+    else            /* 'f' is either greater or less than all integers */
+      return f < 0; /* less? */
+  }
+}
+
+/*
+** Check whether float 'f' is less than or equal to integer 'i'.
+** See comments on previous function.
+*/
+static inline int LEfloatint(lua_Number f, lua_Integer i) {
+  if (l_intfitsf(i))
+    return luai_numle(f, cast_num(i)); /* compare them as floats */
+  else {                               /* f <= i <=> ceil(f) <= i */
+    lua_Integer fi;
+    if (luaV_flttointeger(f, &fi, F2Iceil)) /* fi = ceil(f) */
+      return fi <= i;                       /* compare them as integers */
+    else            /* 'f' is either greater or less than all integers */
+      return f < 0; /* less? */
+  }
+}
+
+/*
+** Return 'l < r', for numbers.
+*/
+static inline int LTnum(const TValue *l, const TValue *r) {
+  lua_assert(ttisnumber(l) && ttisnumber(r));
+  if (ttisinteger(l)) {
+    lua_Integer li = ivalue(l);
+    if (ttisinteger(r))
+      return li < ivalue(r);              /* both are integers */
+    else                                  /* 'l' is int and 'r' is float */
+      return LTintfloat(li, fltvalue(r)); /* l < r ? */
+  } else {
+    lua_Number lf = fltvalue(l); /* 'l' must be float */
+    if (ttisfloat(r))
+      return luai_numlt(lf, fltvalue(r)); /* both are float */
+    else                                  /* 'l' is float and 'r' is int */
+      return LTfloatint(lf, ivalue(r));
+  }
+}
+
+/*
+** Return 'l <= r', for numbers.
+*/
+static inline int LEnum(const TValue *l, const TValue *r) {
+  lua_assert(ttisnumber(l) && ttisnumber(r));
+  if (ttisinteger(l)) {
+    lua_Integer li = ivalue(l);
+    if (ttisinteger(r))
+      return li <= ivalue(r);             /* both are integers */
+    else                                  /* 'l' is int and 'r' is float */
+      return LEintfloat(li, fltvalue(r)); /* l <= r ? */
+  } else {
+    lua_Number lf = fltvalue(l); /* 'l' must be float */
+    if (ttisfloat(r))
+      return luai_numle(lf, fltvalue(r)); /* both are float */
+    else                                  /* 'l' is float and 'r' is int */
+      return LEfloatint(lf, ivalue(r));
+  }
+}
+
+// the helpers too large or too rarely run to be worth inlining are only
+// declared here and defined once, apart from the functions calling them
+int lessthanothers(lua_State *L, const TValue *l, const TValue *r);
+int lessequalothers(lua_State *L, const TValue *l, const TValue *r);
+int forprep(lua_State *L, StkId ra);
+
+/*
+** Execute a step of a float numerical for loop, returning
+** true iff the loop must continue. (The integer case is
+** written online with opcode OP_FORLOOP, for performance.)
+*/
+static inline int iter_number(StkId ra) {
+  lua_Number step = fltvalue(s2v(ra + 2));
+  lua_Number limit = fltvalue(s2v(ra + 1));
+  lua_Number idx = fltvalue(s2v(ra)); /* internal index */
+  idx = luai_numadd(L, idx, step);    /* increment index */
+  if (luai_numlt(0, step) ? luai_numle(idx, limit) : luai_numle(limit, idx)) {
+    chgfltvalue(s2v(ra), idx);     /* update internal index */
+    setfltvalue(s2v(ra + 3), idx); /* and control variable */
+    return 1;                      /* jump back */
+  }
+  return 0;
+}
+
+static inline int iter_integer(StkId ra) {
+  lua_Unsigned count = l_castS2U(ivalue(s2v(ra + 1)));
+  if (count > 0) {
+    lua_Integer step = ivalue(s2v(ra + 2));
+    lua_Integer idx = ivalue(s2v(ra));
+    chgivalue(s2v(ra + 1), count - 1);
+    idx = intop(+, idx, step);
+    chgivalue(s2v(ra), idx);
+    setivalue(s2v(ra + 3), idx);
+    return 1;
+  }
+  return 0;
+}
+
+/*
+** Shift left operation. (Shift right just negates 'y'.)
+*/
+#define luaV_shiftr(x, y) luaV_shiftl(x, -(y))
+
+// the debug library sees the slots of a transpiled closure as upvalues
+// of a C function and can set them to anything, so every slot is checked
+// to still hold what it was made with before it is used
+GCObject *luaA_slot_error(lua_State *L);
+
+#define lua_check_slot(L, o, tag)                                              \
+  (checktag(o, ctb(tag)) ? gcvalue(o) : luaA_slot_error(L))
+
+// transpiled closures are a C closure holding the prototype followed by
+// the upvalues of the Lua function, stored as the objects themselves
+#define lua_get_proto(cl)                                                      \
+  gco2p(lua_check_slot(L, &(cl)->upvalue[0], LUA_VPROTO))
+#define lua_get_upval(cl, n)                                                   \
+  gco2upv(lua_check_slot(L, &(cl)->upvalue[(n) + 1], LUA_VUPVAL))
+
+// only `lua_new_closure` puts a prototype in a C closure, so that marks
+// the closures of transpiled functions
+#define lua_is_native(cl)                                                      \
+  ((cl)->nupvalues != 0 && checktag(&(cl)->upvalue[0], ctb(LUA_VPROTO)))
+
+void pushclosure(lua_State *L, Proto *p, CClosure *encl, StkId base, StkId ra,
+                 lua_CFunction native);
+void pushsharedclosure(lua_State *L, Proto *p, StkId ra, lua_CFunction native);
+
+/*
+** {==================================================================
+** Macros for arithmetic/bitwise/comparison opcodes in 'luaV_execute'
+** ===================================================================
+*/
+
+#define l_addi(L, a, b) intop(+, a, b)
+#define l_subi(L, a, b) intop(-, a, b)
+#define l_muli(L, a, b) intop(*, a, b)
+#define l_band(a, b) intop(&, a, b)
+#define l_bor(a, b) intop(|, a, b)
+#define l_bxor(a, b) intop(^, a, b)
+
+#define l_eqi(a, b) (a == b)
+#define l_lti(a, b) (a < b)
+#define l_lei(a, b) (a <= b)
+#define l_gti(a, b) (a > b)
+#define l_gei(a, b) (a >= b)
+
+#define FK(o) (rt_k + (o))
+#define RA(i) (base + GETARG_A(i))
+#define RB(i) (base + GETARG_B(i))
+#define vRB(i) s2v(RB(i))
+#define KB(i) FK(GETARG_B(i))
+#define RC(i) (base + GETARG_C(i))
+#define vRC(i) s2v(RC(i))
+#define KC(i) FK(GETARG_C(i))
+#define RKC(i) ((TESTARG_k(i)) ? KC(i) : s2v(RC(i)))
+
+void luaA_set_varargs(lua_State *L, CallInfo *ci, int param, int stack);
+void luaA_get_varargs(lua_State *L, CallInfo *ci, StkId where, int num,
+                      int varg);
+void luaA_pretailcall(lua_State *L, CallInfo *ci, StkId func, int args);
+int luaA_posttailcall(lua_State *L, CallInfo *ci);
+void luaA_wrap_closure(lua_State *L, StkId dummy, lua_CFunction native);
+
+// a string constant, kept with its length as it may hold zeros
+typedef struct {
+  char const *data;
+  size_t size;
+} LeanString;
+
+// a constant of a static prototype, where strings are an index into the
+// strings of the module
+typedef struct {
+  lu_byte tt;
+  union {
+    lua_Integer i;
+    lua_Number n;
+    int s;
+  } u;
+} LeanConstant;
+
+// the parts of a prototype the transpiled functions still need
+typedef struct LeanProto {
+  lu_byte numparams;
+  lu_byte is_vararg;
+  lu_byte maxstacksize;
+  int sizek;
+  int sizeupvalues;
+  int sizep;
+  LeanConstant const *k;
+  Upvaldesc const *upvalues;
+  struct LeanProto const *const *p;
+} LeanProto;
+
+void luaA_push_static(lua_State *L, LeanProto const *lp, LeanString const *str,
+                      int nstr, lua_CFunction native);
+
+#ifdef LEAN_PROFILE
+// the instructions counted by each block on a line of a function, and the
+// counters each function keeps of how many times its blocks were entered
+typedef struct {
+  int func;
+  int line;
+  int block;
+  int ninst;
+} LeanSite;
+
+typedef struct {
+  char const *source;
+  int line_defined;
+  unsigned long long const *count;
+  int nblock;
+} LeanFunction;
+#endif
+
+// keeps what a profile found rarely run away from the hot path, where
+// only GCC takes the hint on labels
+#if defined(__GNUC__)
+#define LEAN_COLD_FUNC __attribute__((cold))
+#else
+#define LEAN_COLD_FUNC
+#endif
+
+#if defined(__GNUC__) && !defined(__clang__)
+#define LEAN_COLD_LABEL __attribute__((cold))
+#else
+#define LEAN_COLD_LABEL
+#endif
+
+// keeps the shared helpers of rarely run opcodes from being copied back
+// into every place they are called from
+#if defined(__GNUC__)
+#define LEAN_NOINLINE __attribute__((noinline))
+#else
+#define LEAN_NOINLINE
+#endif
+
+#define lua_next_ci(L) (L->ci->next ? L->ci->next : luaE_extendCI(L))
+
+// custom call for functions of this file, which skips the generic precall
+// as they always finish their own frame before returning
+static inline int luaA_call_native(lua_State *L, StkId func, int nresults) {
+  if (!ttisCclosure(s2v(func)) || L->hookmask)
+    return 0;
+
+  CClosure *cl = clCvalue(s2v(func));
+
+  if (!lua_is_native(cl))
+    return 0;
+
+  L->nCcalls++;
+
+  if (getCcalls(L) >= LUAI_MAXCCALLS)
+    luaE_checkcstack(L);
+
+  checkstackGCp(L, LUA_MINSTACK, func);
+
+  CallInfo *ci = lua_next_ci(L);
+
+  ci->nresults = nresults;
+  ci->callstatus = CIST_C;
+  ci->top = L->top + LUA_MINSTACK;
+  ci->func = func;
+  L->ci = ci;
+  lua_assert(ci->top <= L->stack_last);
+
+  cl->f(L);
+
+  L->nCcalls--;
+
+  return 1;
+}
+
+// returned instead of making a tail call into a function of this file, which
+// the one below then makes in the same frame so tail calls take no C stack
+#define LEAN_TAIL_CALL (-1)
+
+// whether a tail call, already moved down to the frame, can be left to the
+// caller of the function making it
+static inline int luaA_tail_native(lua_State *L, CallInfo *ci) {
+  TValue *func = s2v(ci->func);
+
+  return !L->hookmask && ttisCclosure(func) && lua_is_native(clCvalue(func));
+}
+
+// the entry of every function of this file, which makes the tail calls its
+// body hands back to it; those that were entered this way pass theirs on
+static inline int luaA_enter(lua_State *L, lua_KFunction cont) {
+  int const nested = L->ci->callstatus & CIST_TAIL;
+  int n = cont(L, LUA_OK, 0);
+
+  if (nested)
+    return n;
+
+  while (n == LEAN_TAIL_CALL) {
+    CallInfo *ci = L->ci;
+
+    checkstackGCp(L, LUA_MINSTACK, ci->func);
+    ci->top = L->top + LUA_MINSTACK;
+    ci->callstatus |= CIST_TAIL;
+    n = clCvalue(s2v(ci->func))->f(L);
+  }
+
+  return n;
+}
+
+// moves the arguments of a tail call of a function to itself over its
+// parameters, where they can only be at or above them
+static inline void luaA_move_args(lua_State *L, StkId from, int n_arg,
+                                  StkId base, int n_param) {
+  for (int j = 0; j < n_param; j++) {
+    if (j < n_arg)
+      setobjs2s(L, base + j, from + j);
+    else
+      setnilvalue(s2v(base + j));
+  }
+}
+
+// moves the results of a function copied into its caller down over the
+// callee, as a call leaves them
+static inline void luaA_inline_results(lua_State *L, StkId res, StkId from,
+                                       int n, int wanted) {
+  if (wanted == LUA_MULTRET)
+    wanted = n;
+
+  for (int j = 0; j < wanted; j++) {
+    if (j < n)
+      setobjs2s(L, res + j, from + j);
+    else
+      setnilvalue(s2v(res + j));
+  }
+
+  L->top = res + wanted;
+}
+
+// library functions that calls are done inline for, as they were found
+// when the state was opened; a call is only done inline while its callee
+// is still that function and no hooks are set that would see the call
+enum {
+  LEAN_IPAIRS,
+  LEAN_IPAIRS_AUX,
+  LEAN_NEXT,
+  LEAN_PAIRS,
+  LEAN_RAWGET,
+  LEAN_SELECT,
+  LEAN_TYPE,
+  LEAN_MATH_ABS,
+  LEAN_MATH_FLOOR,
+  LEAN_STRING_BYTE,
+  LEAN_STRING_SUB,
+  LEAN_TABLE_INSERT,
+  LEAN_NUM_BUILTIN
+};
+
+// emitted with the entry point, which fills it in
+extern lua_CFunction lua_builtin_list[LEAN_NUM_BUILTIN];
+
+#define lua_is_builtin(L, v, id)                                               \
+  (!L->hookmask && ttislcf(v) && fvalue(v) == lua_builtin_list[id])
+
+int luaA_ipairs(lua_State *L, StkId ra, Instruction i);
+int luaA_pairs(lua_State *L, StkId ra, Instruction i);
+int luaA_rawget(lua_State *L, StkId ra, Instruction i);
+int luaA_select(lua_State *L, StkId ra, Instruction i);
+int luaA_type(lua_State *L, StkId ra, Instruction i);
+int luaA_math_abs(lua_State *L, StkId ra, Instruction i);
+int luaA_math_floor(lua_State *L, StkId ra, Instruction i);
+int luaA_vararg_select(lua_State *L, CallInfo *ci, StkId ra, Instruction i,
+                       int n_vararg);
+int luaA_string_byte(lua_State *L, StkId ra, Instruction i);
+int luaA_string_sub(lua_State *L, StkId ra, Instruction i);
+int luaA_table_insert(lua_State *L, StkId ra, Instruction i);
+
+// the most a number takes when written as a string
+#define LEAN_MAXNUMBER2STR 44
+
+// how many numbers of a `Concat` are written only once, with the
+// ones past it written again when the result is copied out
+#define LEAN_CONCAT_NUM 8
+
+// bytes a chain of `Concat` ops can build up before it has to be made
+// into a string on the stack like any other
+#define LEAN_CONCAT_PART 256
+
+// marks a chain that fell back, whose first operand is on the stack
+#define LEAN_CONCAT_NONE ((size_t)-1)
+
+// the start of a string built across the `Concat` ops of a chain, when
+// only the last one needs the result as a Lua string
+typedef struct {
+  size_t len;
+  char data[LEAN_CONCAT_PART];
+} LeanConcat;
+
+// numbers written by the measuring pass of a `Concat`
+typedef struct {
+  int len;
+  size_t size[LEAN_CONCAT_NUM];
+  char data[LEAN_CONCAT_NUM][LEAN_MAXNUMBER2STR];
+} LeanNumList;
+
+int luaA_concat_part(lua_State *L, StkId ra, int n, LeanConcat *part,
+                     int first);
+TString *luaA_concat(lua_State *L, StkId ra, int n, LeanConcat *part);
+
+// per-site cache of the node a short string key was last found in
+typedef struct {
+  Node *node;
+  unsigned int index;
+} FieldCache;
+
+// every OS thread gets its own caches, so states run on separate threads
+// never write to the same one; a cache is only ever a hint checked against
+// the table, so states sharing a thread can share it
+#if defined(_MSC_VER) && !defined(__clang__)
+#define LEAN_THREAD_LOCAL __declspec(thread)
+#elif defined(__GNUC__)
+#define LEAN_THREAD_LOCAL __thread
+#else
+#define LEAN_THREAD_LOCAL _Thread_local
+#endif
+
+// custom short string lookup that checks the node remembered by the site
+// first, and only hashes the key when the table or its layout differs
+static inline const TValue *luaA_getshortstr(Table *h, TString *key,
+                                             FieldCache *fc) {
+  if (h->node == fc->node && fc->index < sizenode(h)) {
+    Node *n = gnode(h, fc->index);
+
+    if (keyisshrstr(n) && keystrval(n) == key)
+      return gval(n);
+  }
+
+  const TValue *slot = luaH_getshortstr(h, key);
+
+  if (!isabstkey(slot)) {
+    fc->node = h->node;
+    fc->index = cast_uint(nodefromval(slot) - h->node);
+  }
+
+  return slot;
+}
+
+static inline const TValue *luaA_getstr(Table *h, TString *key,
+                                        FieldCache *fc) {
+  if (key->tt == LUA_VSHRSTR)
+    return luaA_getshortstr(h, key, fc);
+  else
+    return luaH_getstr(h, key);
+}
@@ -12,6 +12,10 @@
   lua_update_base(ci);                                                         \
   ra = RA(i)
 
+#define lua_fastget_cached(t, k, slot, f)                                      \
+  (!ttistable(t) ? (slot = NULL, 0)                                            \
+                 : (slot = f(hvalue(t), k, &cache), !isempty(slot)))
+
 #define lua_update_inst(baked)                                                 \
   Instruction const i = baked;                                                 \
   StkId ra = RA(i)
@@ -57,9 +61,9 @@
 #define op_arithfK(L, fop, fallback)                                           \
   {                                                                            \
     TValue const *v1 = vRB(i);                                                 \
-    TValue const v2 = KC(i);                                                   \
-    lua_assert(ttisnumber(&v2));                                               \
-    op_arithf_aux(L, v1, &v2, fop, fallback);                                  \
+    TValue const *v2 = KC(i);                                                  \
+    lua_assert(ttisnumber(v2));                                                \
+    op_arithf_aux(L, v1, v2, fop, fallback);                                   \
   }
 
 #define op_arith_aux(L, v1, v2, iop, fop, fallback)                            \
@@ -82,17 +86,17 @@
 #define op_arithK(L, iop, fop, fallback)                                       \
   {                                                                            \
     TValue *v1 = vRB(i);                                                       \
-    TValue const v2 = KC(i);                                                   \
-    lua_assert(ttisnumber(&v2));                                               \
-    op_arith_aux(L, v1, &v2, iop, fop, fallback);                              \
+    TValue const *v2 = KC(i);                                                  \
+    lua_assert(ttisnumber(v2));                                                \
+    op_arith_aux(L, v1, v2, iop, fop, fallback);                               \
   }
 
 #define op_bitwiseK(L, op, fallback)                                           \
   {                                                                            \
     TValue *v1 = vRB(i);                                                       \
-    TValue const v2 = KC(i);                                                   \
+    TValue const *v2 = KC(i);                                                  \
     lua_Integer i1;                                                            \
-    lua_Integer i2 = ivalue(&v2);                                              \
+    lua_Integer i2 = ivalue(v2);                                               \
     if (tointegerns(v1, &i1)) {                                                \
       setivalue(s2v(ra), op(i1, i2));                                          \
     } else                                                                     \
@@ -148,6 +152,131 @@
     do_cond_jump(on_true, on_false);                                           \
   }
 
+#define lua_box_integer(r, v) setivalue(s2v(base + r), v)
+
+#define lua_box_number(r, v) setfltvalue(s2v(base + r), v)
+
+#define lua_unbox_integer(r) ivalue(s2v(base + r))
+
+#define lua_unbox_number(r) fltvalue(s2v(base + r))
+
+// a call that may yield resumes through `cont`, which jumps back to the
+// `resume` label of the call site picked by `cont_ctx`
+#define lua_set_cont(cont, cont_ctx)                                           \
+  {                                                                            \
+    ci->u.c.k = cont;                                                          \
+    ci->u.c.ctx = cont_ctx;                                                    \
+  }
+
+#define op_cond_unboxed(baked, expr, on_true, on_false)                        \
+  {                                                                            \
+    Instruction const i = baked;                                               \
+    int const cond = expr;                                                     \
+    do_cond_jump(on_true, on_false);                                           \
+  }
+
+#define op_forprep_unboxed(baked, count, ctl, on_true, on_false)               \
+  {                                                                            \
+    lua_update_inst(baked);                                                    \
+    lua_save_top(L, ci);                                                       \
+    if (forprep(L, ra))                                                        \
+      goto on_true;                                                            \
+    count = ivalue(s2v(ra + 1));                                               \
+    ctl = ivalue(s2v(ra + 3));                                                 \
+    goto on_false;                                                             \
+  }
+
+#define op_forloop_unboxed(idx, count, step, ctl, on_true, on_false)           \
+  {                                                                            \
+    lua_Unsigned const n = l_castS2U(count);                                   \
+    if (n > 0) {                                                               \
+      count = l_castU2S(n - 1);                                                \
+      idx = intop(+, idx, step);                                               \
+      ctl = idx;                                                               \
+      goto on_true;                                                            \
+    } else                                                                     \
+      goto on_false;                                                           \
+  }
+
+// `h` is left as NULL when the register does not hold a table
+#define lua_hoist_table(h, r)                                                  \
+  h = ttistable(s2v(base + r)) ? hvalue(s2v(base + r)) : NULL
+
+// whether raw accesses to `h` from `lo` to `hi` all land in the array
+// part, and missing values there cannot fall back to a metamethod
+#define lua_covers_range(h, lo, hi)                                            \
+  (h != NULL && h->metatable == NULL && lo >= 1 && l_castS2U(hi) <= h->alimit)
+
+// an integer loop indexing tables by its control variable, where `hoist`
+// can use the lowest and highest values the variable takes as `lo` and `hi`
+#define op_forprep_hoisted(baked, count, ctl, hoist, on_true, on_false)        \
+  {                                                                            \
+    lua_update_inst(baked);                                                    \
+    lua_save_top(L, ci);                                                       \
+    if (forprep(L, ra))                                                        \
+      goto on_true;                                                            \
+    count = ivalue(s2v(ra + 1));                                               \
+    ctl = ivalue(s2v(ra + 3));                                                 \
+    {                                                                          \
+      lua_Unsigned const step = l_castS2U(ivalue(s2v(ra + 2)));                \
+      lua_Integer const last =                                                 \
+          l_castU2S(l_castS2U(ctl) + l_castS2U(count) * step);                 \
+      lua_Integer const lo = l_castU2S(step) > 0 ? ctl : last;                 \
+      lua_Integer const hi = l_castU2S(step) > 0 ? last : ctl;                 \
+      cast_void(lo);                                                           \
+      cast_void(hi);                                                           \
+      hoist                                                                    \
+    }                                                                          \
+    goto on_false;                                                             \
+  }
+
+// `GetTable` and `SetTable` at the control variable of such a loop, where
+// `fast` is whether the loop found every access to be in range
+#define op_getarray(baked, h, fast, key)                                       \
+  {                                                                            \
+    lua_update_inst(baked);                                                    \
+    lua_Unsigned const u = l_castS2U(key) - 1u;                                \
+    if (fast || (h != NULL && u < h->alimit && !isempty(&h->array[u]))) {      \
+      TValue const *v = &h->array[u];                                          \
+      if (isempty(v))                                                          \
+        setnilvalue(s2v(ra));                                                  \
+      else                                                                     \
+        setobj2s(L, ra, v);                                                    \
+    } else {                                                                   \
+      const TValue *slot;                                                      \
+      TValue *rb = vRB(i);                                                     \
+      if (luaV_fastgeti(L, rb, key, slot)) {                                   \
+        setobj2s(L, ra, slot);                                                 \
+      } else {                                                                 \
+        TValue k;                                                              \
+        setivalue(&k, key);                                                    \
+        lua_save_top(L, ci);                                                   \
+        luaV_finishget(L, rb, &k, ra, slot);                                   \
+      }                                                                        \
+    }                                                                          \
+  }
+
+#define op_setarray(baked, h, fast, key)                                       \
+  {                                                                            \
+    lua_update_inst(baked);                                                    \
+    lua_Unsigned const u = l_castS2U(key) - 1u;                                \
+    TValue *rc = RKC(i);                                                       \
+    if (fast || (h != NULL && u < h->alimit && !isempty(&h->array[u]))) {      \
+      setobj2t(L, &h->array[u], rc);                                           \
+      luaC_barrierback(L, obj2gco(h), rc);                                     \
+    } else {                                                                   \
+      const TValue *slot;                                                      \
+      if (luaV_fastgeti(L, s2v(ra), key, slot)) {                              \
+        luaV_finishfastset(L, s2v(ra), slot, rc);                              \
+      } else {                                                                 \
+        TValue k;                                                              \
+        setivalue(&k, key);                                                    \
+        lua_save_top(L, ci);                                                   \
+        luaV_finishset(L, s2v(ra), &k, rc, slot);                              \
+      }                                                                        \
+    }                                                                          \
+  }
+
 #define Move(baked)                                                            \
   {                                                                            \
     lua_update_inst(baked);                                                    \
@@ -168,14 +297,14 @@
 #define LoadK(baked)                                                           \
   {                                                                            \
     lua_update_inst(baked);                                                    \
-    TValue const rb = FK(GETARG_Bx(i));                                        \
-    setobj2s(L, ra, &rb);                                                      \
+    TValue const *rb = FK(GETARG_Bx(i));                                       \
+    setobj2s(L, ra, rb);                                                       \
   }
 #define LoadKX(baked, extra)                                                   \
   {                                                                            \
     lua_update_inst(baked);                                                    \
-    TValue const rb = FK(extra);                                               \
-    setobj2s(L, ra, &rb);                                                      \
+    TValue const *rb = FK(extra);                                              \
+    setobj2s(L, ra, rb);                                                       \
   }
 #define LoadFalse(baked)                                                       \
   {                                                                            \
@@ -206,13 +335,13 @@
   {                                                                            \
     lua_update_inst(baked);                                                    \
     int b = GETARG_B(i);                                                       \
-    setobj2s(L, ra, cl->upvals[b]->v);                                         \
+    setobj2s(L, ra, lua_get_upval(cl, b)->v);                                  \
   }
 
 #define SetUpval(baked)                                                        \
   {                                                                            \
     lua_update_inst(baked);                                                    \
-    UpVal *uv = cl->upvals[GETARG_B(i)];                                       \
+    UpVal *uv = lua_get_upval(cl, GETARG_B(i));                                \
     setobj(L, uv->v, s2v(ra));                                                 \
     luaC_barrier(L, uv, s2v(ra));                                              \
   }
@@ -221,14 +350,15 @@
   {                                                                            \
     lua_update_inst(baked);                                                    \
     const TValue *slot;                                                        \
-    TValue *upval = cl->upvals[GETARG_B(i)]->v;                                \
-    TValue rc = KC(i);                                                         \
-    TString *key = tsvalue(&rc);                                               \
-    if (luaV_fastget(L, upval, key, slot, luaH_getshortstr)) {                 \
+    static LEAN_THREAD_LOCAL FieldCache cache;                                 \
+    TValue *upval = lua_get_upval(cl, GETARG_B(i))->v;                         \
+    TValue *rc = KC(i);                                                        \
+    TString *key = tsvalue(rc);                                                \
+    if (lua_fastget_cached(upval, key, slot, luaA_getshortstr)) {              \
       setobj2s(L, ra, slot);                                                   \
     } else {                                                                   \
       lua_save_top(L, ci);                                                     \
-      luaV_finishget(L, upval, &rc, ra, slot);                                 \
+      luaV_finishget(L, upval, rc, ra, slot);                                  \
     }                                                                          \
   }
 
@@ -269,14 +399,15 @@
   {                                                                            \
     lua_update_inst(baked);                                                    \
     const TValue *slot;                                                        \
+    static LEAN_THREAD_LOCAL FieldCache cache;                                 \
     TValue *rb = vRB(i);                                                       \
-    TValue rc = KC(i);                                                         \
-    TString *key = tsvalue(&rc);                                               \
-    if (luaV_fastget(L, rb, key, slot, luaH_getshortstr)) {                    \
+    TValue *rc = KC(i);                                                        \
+    TString *key = tsvalue(rc);                                                \
+    if (lua_fastget_cached(rb, key, slot, luaA_getshortstr)) {                 \
       setobj2s(L, ra, slot);                                                   \
     } else {                                                                   \
       lua_save_top(L, ci);                                                     \
-      luaV_finishget(L, rb, &rc, ra, slot);                                    \
+      luaV_finishget(L, rb, rc, ra, slot);                                     \
     }                                                                          \
   }
 
@@ -284,15 +415,16 @@
   {                                                                            \
     Instruction const i = baked;                                               \
     const TValue *slot;                                                        \
-    TValue *upval = cl->upvals[GETARG_A(i)]->v;                                \
-    TValue rb = KB(i);                                                         \
-    TValue rc = RKC(i);                                                        \
-    TString *key = tsvalue(&rb);                                               \
-    if (luaV_fastget(L, upval, key, slot, luaH_getshortstr)) {                 \
-      luaV_finishfastset(L, upval, slot, &rc);                                 \
+    static LEAN_THREAD_LOCAL FieldCache cache;                                 \
+    TValue *upval = lua_get_upval(cl, GETARG_A(i))->v;                         \
+    TValue *rb = KB(i);                                                        \
+    TValue *rc = RKC(i);                                                       \
+    TString *key = tsvalue(rb);                                                \
+    if (lua_fastget_cached(upval, key, slot, luaA_getshortstr)) {              \
+      luaV_finishfastset(L, upval, slot, rc);                                  \
     } else {                                                                   \
       lua_save_top(L, ci);                                                     \
-      luaV_finishset(L, upval, &rb, &rc, slot);                                \
+      luaV_finishset(L, upval, rb, rc, slot);                                  \
     }                                                                          \
   }
 
@@ -301,15 +433,15 @@
     lua_update_inst(baked);                                                    \
     const TValue *slot;                                                        \
     TValue *rb = vRB(i);                                                       \
-    TValue rc = RKC(i);                                                        \
+    TValue *rc = RKC(i);                                                       \
     lua_Unsigned n;                                                            \
     if (ttisinteger(rb)                                                        \
             ? (cast_void(n = ivalue(rb)), luaV_fastgeti(L, s2v(ra), n, slot))  \
             : luaV_fastget(L, s2v(ra), rb, slot, luaH_get)) {                  \
-      luaV_finishfastset(L, s2v(ra), slot, &rc);                               \
+      luaV_finishfastset(L, s2v(ra), slot, rc);                                \
     } else {                                                                   \
       lua_save_top(L, ci);                                                     \
-      luaV_finishset(L, s2v(ra), rb, &rc, slot);                               \
+      luaV_finishset(L, s2v(ra), rb, rc, slot);                                \
     }                                                                          \
   }
 
@@ -318,14 +450,14 @@
     lua_update_inst(baked);                                                    \
     const TValue *slot;                                                        \
     int c = GETARG_B(i);                                                       \
-    TValue rc = RKC(i);                                                        \
+    TValue *rc = RKC(i);                                                       \
     if (luaV_fastgeti(L, s2v(ra), c, slot)) {                                  \
-      luaV_finishfastset(L, s2v(ra), slot, &rc);                               \
+      luaV_finishfastset(L, s2v(ra), slot, rc);                                \
     } else {                                                                   \
       TValue key;                                                              \
       setivalue(&key, c);                                                      \
       lua_save_top(L, ci);                                                     \
-      luaV_finishset(L, s2v(ra), &key, &rc, slot);                             \
+      luaV_finishset(L, s2v(ra), &key, rc, slot);                              \
     }                                                                          \
   }
 
@@ -333,14 +465,15 @@
   {                                                                            \
     lua_update_inst(baked);                                                    \
     const TValue *slot;                                                        \
-    TValue rb = KB(i);                                                         \
-    TValue rc = RKC(i);                                                        \
-    TString *key = tsvalue(&rb);                                               \
-    if (luaV_fastget(L, s2v(ra), key, slot, luaH_getshortstr)) {               \
-      luaV_finishfastset(L, s2v(ra), slot, &rc);                               \
+    static LEAN_THREAD_LOCAL FieldCache cache;                                 \
+    TValue *rb = KB(i);                                                        \
+    TValue *rc = RKC(i);                                                       \
+    TString *key = tsvalue(rb);                                                \
+    if (lua_fastget_cached(s2v(ra), key, slot, luaA_getshortstr)) {            \
+      luaV_finishfastset(L, s2v(ra), slot, rc);                                \
     } else {                                                                   \
       lua_save_top(L, ci);                                                     \
-      luaV_finishset(L, s2v(ra), &rb, &rc, slot);                              \
+      luaV_finishset(L, s2v(ra), rb, rc, slot);                                \
     }                                                                          \
   }
 
@@ -370,15 +503,16 @@
   {                                                                            \
     lua_update_inst(baked);                                                    \
     const TValue *slot;                                                        \
+    static LEAN_THREAD_LOCAL FieldCache cache;                                 \
     TValue *rb = vRB(i);                                                       \
-    TValue rc = RKC(i);                                                        \
-    TString *key = tsvalue(&rc);                                               \
+    TValue *rc = RKC(i);                                                       \
+    TString *key = tsvalue(rc);                                                \
     setobj2s(L, ra + 1, rb);                                                   \
-    if (luaV_fastget(L, rb, key, slot, luaH_getstr)) {                         \
+    if (lua_fastget_cached(rb, key, slot, luaA_getstr)) {                      \
       setobj2s(L, ra, slot);                                                   \
     } else {                                                                   \
       lua_save_top(L, ci);                                                     \
-      luaV_finishget(L, rb, &rc, ra, slot);                                    \
+      luaV_finishget(L, rb, rc, ra, slot);                                     \
     }                                                                          \
   }
 
@@ -549,12 +683,12 @@
   {                                                                            \
     Instruction const pi = i;                                                  \
     lua_update_inst(baked);                                                    \
-    TValue const imm = KB(i);                                                  \
+    TValue const *imm = KB(i);                                                 \
     TMS tm = (TMS)GETARG_C(i);                                                 \
     int flip = GETARG_k(i);                                                    \
     StkId result = RA(pi);                                                     \
     lua_save_top(L, ci);                                                       \
-    luaT_trybinassocTM(L, s2v(ra), &imm, flip, result, tm);                    \
+    luaT_trybinassocTM(L, s2v(ra), imm, flip, result, tm);                     \
   }
 
 #define Unm(baked)                                                             \
@@ -603,13 +737,47 @@
     lua_save_top(L, ci);                                                       \
     luaV_objlen(L, ra, vRB(i));                                                \
   }
+
+// strings and numbers are joined into one result allocated up front, with
+// anything else left to 'luaV_concat'; `part` is the start of a chain
+#define lua_join(L, ra, n, part)                                               \
+  {                                                                            \
+    L->top = ra + n;                                                           \
+    TString *const ts = luaA_concat(L, ra, n, part);                           \
+    if (ts != NULL) {                                                          \
+      setsvalue2s(L, ra, ts);                                                  \
+      L->top = ra + 1;                                                         \
+    } else {                                                                   \
+      luaV_concat(L, n);                                                       \
+    }                                                                          \
+    lua_check_gc(L, L->top);                                                   \
+  }
+
 #define Concat(baked)                                                          \
+  {                                                                            \
+    lua_update_inst(baked);                                                    \
+    int const n = GETARG_B(i);                                                 \
+    lua_join(L, ra, n, NULL);                                                  \
+  }
+
+// a `Concat` whose result only goes on to the next one of its chain, built
+// up in `concat_part` instead of being made a string
+#define op_concat_part(baked, first)                                           \
   {                                                                            \
     lua_update_inst(baked);                                                    \
     int const n = GETARG_B(i);                                                 \
     L->top = ra + n;                                                           \
-    luaV_concat(L, n);                                                         \
-    lua_check_gc(L, L->top);                                                   \
+    if (!luaA_concat_part(L, ra, n, &concat_part, first)) {                    \
+      lua_join(L, ra, n, NULL);                                                \
+    }                                                                          \
+  }
+
+// the last `Concat` of a chain, which makes the whole of it a string
+#define op_concat_end(baked)                                                   \
+  {                                                                            \
+    lua_update_inst(baked);                                                    \
+    int const n = GETARG_B(i);                                                 \
+    lua_join(L, ra, n, &concat_part);                                          \
   }
 
 #define Close(baked)                                                           \
@@ -646,8 +814,8 @@
 #define EqK(baked, on_true, on_false)                                          \
   {                                                                            \
     lua_update_inst(baked);                                                    \
-    TValue const rb = KB(i);                                                   \
-    int cond = luaV_rawequalobj(s2v(ra), &rb);                                 \
+    TValue *rb = KB(i);                                                        \
+    int cond = luaV_rawequalobj(s2v(ra), rb);                                  \
     do_cond_jump(on_true, on_false);                                           \
   }
 #define EqI(baked, on_true, on_false)                                          \
@@ -700,7 +868,7 @@
       goto on_false;                                                           \
     }                                                                          \
   }
-#define Call(baked)                                                            \
+#define Call(baked, cont, ctx, resume)                                         \
   {                                                                            \
     lua_update_inst(baked);                                                    \
     int b = GETARG_B(i);                                                       \
@@ -709,11 +877,100 @@
     if (b != 0)                                                                \
       L->top = ra + b;                                                         \
                                                                                \
-    luaD_callnoyield(L, ra, nresults);                                         \
+    lua_set_cont(cont, ctx);                                                   \
+                                                                               \
+    if (!luaA_call_native(L, ra, nresults))                                    \
+      luaD_call(L, ra, nresults);                                              \
+  }                                                                            \
+  resume:                                                                      \
+  lua_update_base(ci);
+
+// a `Call` to a library function done inline by `intrinsic` when the callee
+// is still that function, and made as usual through `call` otherwise
+#define op_intrinsic(baked, intrinsic, call)                                   \
+  if (!intrinsic(L, RA(baked), baked)) {                                       \
+    call;                                                                      \
+  }
+
+// a `Call` to `select` over all of `...`, loaded by `vararg` right before
+// it, which reads the varargs in place while the callee is still `select`
+#define op_vararg_select(baked, vararg, call)                                  \
+  lua_save_top(L, ci);                                                         \
+  if (luaA_vararg_select(L, ci, RA(baked), baked, n_vararg)) {                 \
     lua_update_base(ci);                                                       \
+  } else {                                                                     \
+    Vararg(vararg);                                                            \
+    call;                                                                      \
   }
 
-#define TailCall(baked)                                                        \
+// a `TailCall` to the running function, checked against the callee as it
+// may have been changed, starts it over with the arguments as parameters
+#define op_self_call(baked, num_param, start, call)                            \
+  {                                                                            \
+    lua_update_inst(baked);                                                    \
+    int b = GETARG_B(i);                                                       \
+                                                                               \
+    if (b == 0)                                                                \
+      b = cast_int(L->top - ra);                                               \
+                                                                               \
+    if (!L->hookmask && ttisCclosure(s2v(ra)) && clCvalue(s2v(ra)) == cl) {    \
+      if (TESTARG_k(i))                                                        \
+        luaF_closeupval(L, base);                                              \
+      luaA_move_args(L, ra + 1, b - 1, base, num_param);                       \
+      L->top = base + num_param;                                               \
+      goto start;                                                              \
+    }                                                                          \
+  }                                                                            \
+  call;
+
+// a `Call` to a function copied into the caller is only done inline while
+// the callee is still that function and no hooks are set that would see it
+#define lua_is_inline(baked, native)                                           \
+  (!L->hookmask && ttisCclosure(s2v(RA(baked))) &&                             \
+   clCvalue(s2v(RA(baked)))->f == native)
+
+// makes room for the registers of a copied function above its arguments
+// and fills in the parameters that were not passed
+#define op_inline_enter(baked, num_param, size)                                \
+  {                                                                            \
+    lua_update_inst(baked);                                                    \
+    int b = GETARG_B(i);                                                       \
+                                                                               \
+    L->top = ra + b;                                                           \
+                                                                               \
+    if (ra + 1 + size > ci->top) {                                             \
+      checkstackGCp(L, size + 1 - b, ra);                                      \
+      lua_update_base(ci);                                                     \
+      ci->top = ra + 1 + size;                                                 \
+    }                                                                          \
+                                                                               \
+    for (; b <= num_param; b++)                                                \
+      setnilvalue(s2v(ra + b));                                                \
+  }
+
+// the frame of a copied function, which starts above the callee and
+// reads its constants and upvalues from it
+#define lua_inline_frame(baked)                                                \
+  StkId const frame = RA(baked) + 1;                                           \
+  CClosure *const cl = clCvalue(s2v(frame - 1));                               \
+  TValue *const rt_k = lua_get_proto(cl)->k;                                   \
+  StkId base = frame;
+
+// a return from a copied function leaves its results where the call would
+// have and goes on after it
+#define op_inline_return(baked, nresults, done)                                \
+  {                                                                            \
+    lua_update_inst(baked);                                                    \
+    int n = GETARG_B(i) - 1;                                                   \
+                                                                               \
+    if (n < 0)                                                                 \
+      n = cast_int(L->top - ra);                                               \
+                                                                               \
+    luaA_inline_results(L, base - 1, ra, n, nresults);                         \
+    goto done;                                                                 \
+  }
+
+#define TailCall(baked, cont, ctx, resume)                                     \
   {                                                                            \
     lua_update_inst(baked);                                                    \
     int b = GETARG_B(i);                                                       \
@@ -737,22 +994,24 @@
                                                                                \
     int n_param = GETARG_C(i);                                                 \
                                                                                \
-    if (n_param) {                                                             \
+    if (n_param && n_vararg) {                                                 \
       ci->func -= n_vararg + n_param;                                          \
     }                                                                          \
                                                                                \
     if (ttisLclosure(s2v(ra))) {                                               \
       luaD_pretailcall(L, ci, ra, b);                                          \
+      lua_set_cont(cont, ctx);                                                 \
       luaD_call(L, ci->func, LUA_MULTRET);                                     \
     } else {                                                                   \
       luaA_pretailcall(L, ci, ra, b);                                          \
+      if (status == LUA_OK && luaA_tail_native(L, ci))                         \
+        return LEAN_TAIL_CALL;                                                 \
+      lua_set_cont(cont, ctx);                                                 \
       luaD_precall(L, ci->func, LUA_MULTRET);                                  \
     }                                                                          \
-                                                                               \
-    lua_update_stack(ci);                                                      \
-                                                                               \
-    return cast_int(L->top - ci->func);                                        \
-  }
+  }                                                                            \
+  resume:                                                                      \
+  return luaA_posttailcall(L, ci);
 
 #define Return(baked)                                                          \
   {                                                                            \
@@ -771,7 +1030,7 @@
                                                                                \
     int n_param = GETARG_C(i);                                                 \
                                                                                \
-    if (n_param) {                                                             \
+    if (n_param && n_vararg) {                                                 \
       ci->func -= n_vararg + n_param;                                          \
     }                                                                          \
                                                                                \
@@ -844,14 +1103,16 @@
                                                                                \
     goto on_true;                                                              \
   }
-#define TForCall(baked)                                                        \
+#define TForCall(baked, cont, ctx, resume)                                     \
   {                                                                            \
     lua_update_inst(baked);                                                    \
     memcpy(ra + 4, ra, 3 * sizeof(*ra));                                       \
     L->top = ra + 4 + 3;                                                       \
+    lua_set_cont(cont, ctx);                                                   \
     luaD_call(L, ra + 4, GETARG_C(i));                                         \
-    lua_update_stack(ci);                                                      \
-  }
+  }                                                                            \
+  resume:                                                                      \
+  lua_update_base(ci);
 #define TForLoop(baked, on_true, on_false)                                     \
   {                                                                            \
     lua_update_inst(baked);                                                    \
@@ -891,11 +1152,14 @@
 #define Closure(baked, native)                                                 \
   {                                                                            \
     lua_update_inst(baked);                                                    \
-    Proto *p = cl->p->p[GETARG_Bx(i)];                                         \
+    Proto *p = lua_get_proto(cl)->p[GETARG_Bx(i)];                             \
                                                                                \
     lua_save_top(L, ci);                                                       \
-    pushclosure(L, p, cl->upvals, base, ra);                                   \
-    luaA_wrap_closure(L, ra, native);                                          \
+                                                                               \
+    if (p->sizeupvalues == 0)                                                  \
+      pushsharedclosure(L, p, ra, native);                                     \
+    else                                                                       \
+      pushclosure(L, p, cl, base, ra, native);                                 \
                                                                                \
     lua_check_gc(L, ra + 1);                                                   \
   }
@@ -911,9 +1175,28 @@
 
 #define VarargPrep(baked)                                                      \
   {                                                                            \
-    luaA_set_varargs(L, ci, GETARG_A(baked), cl->p->maxstacksize);             \
+    luaA_set_varargs(L, ci, GETARG_A(baked), lua_get_proto(cl)->maxstacksize); \
     lua_update_base(ci);                                                       \
   }
 
 #define ExtraArg(baked) lua_assert(0)
 #define Invalid(baked) lua_assert(0)
+
+// shared helpers for opcodes that are rarely run, which the levels that
+// favour size call through `op_outline` instead of expanding each opcode
+// in place; they run in the frame they are given, which may be that of a
+// function copied into its caller
+#define lua_outline_frame lua_State *L, CallInfo *ci, CClosure *cl, StkId base
+
+#define op_outline(name, ...)                                                  \
+  { luaA_outline_##name(L, ci, cl, base, __VA_ARGS__); }
+
+void luaA_outline_Close(lua_outline_frame, Instruction baked);
+void luaA_outline_Tbc(lua_outline_frame, Instruction baked);
+void luaA_outline_Len(lua_outline_frame, Instruction baked);
+void luaA_outline_Concat(lua_outline_frame, Instruction baked);
+void luaA_outline_SetList(lua_outline_frame, Instruction baked, int extra);
+void luaA_outline_Vararg(lua_outline_frame, Instruction baked, int n_vararg);
+void luaA_outline_MmBin(lua_outline_frame, Instruction baked, Instruction i);
+void luaA_outline_MmBinI(lua_outline_frame, Instruction baked, Instruction i);
+void luaA_outline_MmBinK(lua_outline_frame, Instruction baked, Instruction i);
@@ -1,3 +1,70 @@
+// a bundled module, installed into `package.preload` under its name
+// its prototypes are either built from `proto` or undumped from `glue`
+typedef struct {
+  char const *name;
+  char const *glue;
+  size_t size;
+  LeanProto const *proto;
+  LeanString const *str;
+  int nstr;
+  lua_CFunction root;
+} LeanModule;
+
+static LeanModule const lua_entry = `ENTRY`;
+
+static LeanModule const lua_module_list[] = {`MODULE_LIST`{NULL}};
+
+lua_CFunction lua_builtin_list[LEAN_NUM_BUILTIN];
+
+static struct {
+  int id;
+  char const *lib;
+  char const *name;
+} const lua_builtin_name[] = {
+    {LEAN_IPAIRS, NULL, "ipairs"},
+    {LEAN_NEXT, NULL, "next"},
+    {LEAN_PAIRS, NULL, "pairs"},
+    {LEAN_RAWGET, NULL, "rawget"},
+    {LEAN_SELECT, NULL, "select"},
+    {LEAN_TYPE, NULL, "type"},
+    {LEAN_MATH_ABS, "math", "abs"},
+    {LEAN_MATH_FLOOR, "math", "floor"},
+    {LEAN_STRING_BYTE, "string", "byte"},
+    {LEAN_STRING_SUB, "string", "sub"},
+    {LEAN_TABLE_INSERT, "table", "insert"},
+};
+
+// remembers the library functions that calls are done inline for, along
+// with the iterator `ipairs` returns, which is only found by calling it
+void lua_find_builtin_list(lua_State *L) {
+  size_t len = sizeof(lua_builtin_name) / sizeof(lua_builtin_name[0]);
+
+  for (size_t i = 0; i < len; i++) {
+    lua_pushglobaltable(L);
+
+    if (lua_builtin_name[i].lib != NULL) {
+      lua_getfield(L, -1, lua_builtin_name[i].lib);
+      lua_remove(L, -2);
+    }
+
+    if (lua_type(L, -1) == LUA_TTABLE) {
+      lua_getfield(L, -1, lua_builtin_name[i].name);
+      lua_builtin_list[lua_builtin_name[i].id] = lua_tocfunction(L, -1);
+      lua_pop(L, 1);
+    }
+
+    lua_pop(L, 1);
+  }
+
+  if (lua_builtin_list[LEAN_IPAIRS] != NULL) {
+    lua_pushcfunction(L, lua_builtin_list[LEAN_IPAIRS]);
+    lua_newtable(L);
+    lua_call(L, 1, 1);
+    lua_builtin_list[LEAN_IPAIRS_AUX] = lua_tocfunction(L, -1);
+    lua_pop(L, 1);
+  }
+}
+
 int lua_error_handler(lua_State *L) {
   char const *msg = lua_tostring(L, 1);
 
@@ -14,15 +81,47 @@ int lua_error_handler(lua_State *L) {
   return 1;
 }
 
-int lua_main(lua_State *L) {
-  int status = luaL_loadbuffer(L, BT_GLUE, `LENGTH`, BT_GLUE);
+// pushes the closure of the root function of a module
+void lua_push_module(lua_State *L, LeanModule const *m) {
+  if (m->proto != NULL) {
+    luaA_push_static(L, m->proto, m->str, m->nstr, m->root);
+    return;
+  }
+
+  int status = luaL_loadbuffer(L, m->glue, m->size, m->name);
 
   if (status != LUA_OK) {
     lua_error(L);
-    return 0;
+    return;
   }
 
-  luaA_wrap_closure(L, L->top - 1, lua_func_0);
+  luaA_wrap_closure(L, L->top - 1, m->root);
+}
+
+// the loader `require` finds in `package.preload`, which only builds the
+// prototypes of the module the first time it is required
+int lua_load_module(lua_State *L) {
+  lua_push_module(L, lua_touserdata(L, lua_upvalueindex(1)));
+  lua_insert(L, 1);
+  lua_call(L, lua_gettop(L) - 1, 1);
+
+  return 1;
+}
+
+void lua_open_module_list(lua_State *L) {
+  luaL_getsubtable(L, LUA_REGISTRYINDEX, LUA_PRELOAD_TABLE);
+
+  for (LeanModule const *m = lua_module_list; m->name != NULL; m++) {
+    lua_pushlightuserdata(L, (void *)m);
+    lua_pushcclosure(L, &lua_load_module, 1);
+    lua_setfield(L, -2, m->name);
+  }
+
+  lua_pop(L, 1);
+}
+
+int lua_main(lua_State *L) {
+  lua_push_module(L, &lua_entry);
 
   int num_arg = lua_tointeger(L, 1);
   char **list_arg = lua_touserdata(L, 2);
@@ -36,6 +135,75 @@ int lua_main(lua_State *L) {
   return 0;
 }
 
+#ifdef LEAN_PROFILE
+#define lua_site_count(s)                                                      \
+  (lua_profile_func[(s)->func].count[(s)->block] * (s)->ninst)
+
+// writes how many instructions ran in each function and on each of their
+// lines as CSV, to the file named by `LEAN_PROFILE_FILE`, followed by how
+// many times each block ran for a later build to be guided by, after the
+// number of blocks of the function so that build can tell it is the same
+void lua_write_profile(void) {
+  char const *name = getenv("LEAN_PROFILE_FILE");
+
+  if (name == NULL)
+    name = "lean_profile.csv";
+
+  FILE *file = fopen(name, "w");
+
+  if (file == NULL) {
+    lua_writestringerror("cannot open profile '%s'\n", name);
+    return;
+  }
+
+  int nfunc = sizeof(lua_profile_func) / sizeof(lua_profile_func[0]);
+  int nsite = sizeof(lua_profile_site) / sizeof(lua_profile_site[0]);
+  LeanSite const *site = lua_profile_site;
+  LeanSite const *end = site + nsite;
+
+  fprintf(file, "kind,function,source,index,count\n");
+
+  for (int i = 0; i < nfunc; i++) {
+    LeanFunction const *f = &lua_profile_func[i];
+    LeanSite const *first = site;
+    unsigned long long total = 0;
+
+    for (; site != end && site->func == i; site++)
+      total += lua_site_count(site);
+
+    fprintf(file, "function,%d,\"%s\",%d,%llu\n", i, f->source,
+            f->line_defined, total);
+
+    while (first != site) {
+      int line = first->line;
+      unsigned long long count = 0;
+
+      for (; first != site && first->line == line; first++)
+        count += lua_site_count(first);
+
+      if (count != 0)
+        fprintf(file, "line,%d,\"%s\",%d,%llu\n", i, f->source, line, count);
+    }
+  }
+
+  for (int i = 0; i < nfunc; i++) {
+    LeanFunction const *f = &lua_profile_func[i];
+
+    fprintf(file, "blocks,%d,\"%s\",%d,%d\n", i, f->source, f->line_defined,
+            f->nblock);
+
+    for (int b = 0; b < f->nblock; b++) {
+      unsigned long long count = f->count[b];
+
+      if (count != 0)
+        fprintf(file, "block,%d,\"%s\",%d,%llu\n", i, f->source, b, count);
+    }
+  }
+
+  fclose(file);
+}
+#endif
+
 int main(int argc, char *argv[]) {
   lua_State *L = luaL_newstate();
 
@@ -44,6 +212,8 @@ int main(int argc, char *argv[]) {
   }
 
   luaL_openlibs(L);
+  lua_find_builtin_list(L);
+  lua_open_module_list(L);
   lua_gc(L, LUA_GCGEN, 0, 0);
 
   lua_pushcfunction(L, &lua_error_handler);
@@ -63,5 +233,9 @@ int main(int argc, char *argv[]) {
   lua_pop(L, 1);
   lua_close(L);
 
+#ifdef LEAN_PROFILE
+  lua_write_profile();
+#endif
+
   return status == LUA_OK ? 0 : 1;
 }
@@ -0,0 +1,705 @@
+use crate::{
+	codegen::infer::{Arith, Inference, Kind, Operand},
+	common::types::{Inst, Opcode, Proto, Value},
+};
+use std::{
+	collections::HashMap,
+	io::{Result, Write},
+};
+
+fn local_name(range: usize, kind: Kind) -> String {
+	match kind {
+		Kind::Integer => format!("int_{}", range),
+		Kind::Number => format!("num_{}", range),
+		Kind::Unknown | Kind::Any => unreachable!("live range {} is boxed", range),
+	}
+}
+
+// numeric constants are written as C literals so they fold into
+// the surrounding expression instead of being loaded from `rt_k`
+pub fn literal(value: &Value) -> String {
+	match value {
+		Value::Integer(i) if *i == i64::MIN => "LUA_MININTEGER".to_string(),
+		Value::Integer(i) => i.to_string(),
+		Value::Number(n) if n.is_nan() => "(0.0 / 0.0)".to_string(),
+		Value::Number(n) if n.is_infinite() && *n > 0.0 => "HUGE_VAL".to_string(),
+		Value::Number(n) if n.is_infinite() => "(-HUGE_VAL)".to_string(),
+		Value::Number(n) => format!("{:?}", n),
+		_ => String::new(),
+	}
+}
+
+fn box_name(kind: Kind) -> &'static str {
+	match kind {
+		Kind::Integer => "lua_box_integer",
+		Kind::Number => "lua_box_number",
+		Kind::Unknown | Kind::Any => unreachable!("kind is boxed"),
+	}
+}
+
+fn unbox_name(kind: Kind) -> &'static str {
+	match kind {
+		Kind::Integer => "lua_unbox_integer",
+		Kind::Number => "lua_unbox_number",
+		Kind::Unknown | Kind::Any => unreachable!("kind is boxed"),
+	}
+}
+
+// registers below this survive a call that may yield
+fn kept_below(inst: Inst) -> usize {
+	match inst.opcode() {
+		Opcode::TailCall => 0,
+		Opcode::TForCall => inst.a() as usize + 4,
+		_ => inst.a() as usize,
+	}
+}
+
+// an integer loop whose body reads or writes tables at its control variable
+// the tables are taken out of their registers once when the loop starts,
+// and `is_pure` loops also check there that every access will hit the
+// array part, as nothing in them can run code that would change that
+struct ArrayLoop {
+	prep: usize,
+	post: usize,
+	table_list: Vec<usize>,
+	is_pure: bool,
+}
+
+impl ArrayLoop {
+	fn table_name(&self, reg: usize) -> String {
+		format!("tab_{}_{}", self.prep, reg)
+	}
+
+	fn fast_name(&self) -> String {
+		if self.is_pure {
+			format!("fast_{}", self.prep)
+		} else {
+			"0".to_string()
+		}
+	}
+}
+
+// emits numeric instructions over C locals instead of stack slots
+// `dirty` tracks which registers have a local ahead of their stack slot,
+// and those are written back only right before something reads the slot
+// `current` is the live range each register is in at the instruction
+pub struct Unboxed {
+	infer: Inference,
+	dirty: Vec<Option<usize>>,
+	current: Vec<Option<usize>>,
+	literal_list: Vec<String>,
+	array_list: Vec<ArrayLoop>,
+	access_map: HashMap<usize, usize>,
+}
+
+impl Unboxed {
+	pub fn new(proto: &Proto) -> Self {
+		let infer = Inference::new(proto);
+		let dirty = vec![None; usize::from(proto.num_stack)];
+		let current = dirty.clone();
+		let literal_list = proto.value_list.iter().map(literal).collect();
+		let mut result = Self {
+			infer,
+			dirty,
+			current,
+			literal_list,
+			array_list: Vec::new(),
+			access_map: HashMap::new(),
+		};
+
+		let code: Vec<Inst> = proto
+			.block_list
+			.iter()
+			.flat_map(|v| v.code.iter().copied())
+			.collect();
+
+		result.find_array_loops(&code);
+		result
+	}
+
+	// the table and key registers of an access by integer key
+	fn array_access(inst: Inst) -> Option<(usize, usize)> {
+		match inst.opcode() {
+			Opcode::GetTable => Some((inst.b() as usize, inst.c() as usize)),
+			Opcode::SetTable => Some((inst.a() as usize, inst.b() as usize)),
+			_ => None,
+		}
+	}
+
+	// finds the table accesses at the control variable of an integer loop,
+	// where the variable is not changed by the body and the table register
+	// is changed by nothing until the loop is done
+	fn find_array_loops(&mut self, code: &[Inst]) {
+		for (prep, post) in self.infer.loop_list() {
+			if self.infer.loop_kind(prep) != Kind::Integer {
+				continue;
+			}
+
+			let ctl = code[prep].a() as usize + 3;
+			let body = prep + 1..post;
+			let ctl_list = [
+				self.infer.def_range(prep, ctl),
+				self.infer.def_range(post, ctl),
+			];
+
+			if body
+				.clone()
+				.any(|pc| self.infer.def_range(pc, ctl).is_some())
+			{
+				continue;
+			}
+
+			let mut access_list = Vec::new();
+			let mut table_list = Vec::new();
+
+			for pc in body.clone() {
+				let (table, key) = match Self::array_access(code[pc]) {
+					Some(pair) => pair,
+					None => continue,
+				};
+
+				let range = self.infer.use_range(pc, key);
+				let is_ctl = range.is_some() && ctl_list.contains(&range);
+				let is_kept = !self.infer.is_captured(table)
+					&& (prep + 1..=post).all(|v| self.infer.def_range(v, table).is_none());
+
+				if is_ctl && is_kept {
+					access_list.push(pc);
+
+					if !table_list.contains(&table) {
+						table_list.push(table);
+					}
+				}
+			}
+
+			if access_list.is_empty() {
+				continue;
+			}
+
+			let is_pure = body
+				.clone()
+				.all(|pc| access_list.contains(&pc) || self.is_pure(pc, code[pc]));
+
+			for pc in access_list {
+				self.access_map.insert(pc, self.array_list.len());
+			}
+
+			self.array_list.push(ArrayLoop {
+				prep,
+				post,
+				table_list,
+				is_pure,
+			});
+		}
+	}
+
+	// whether an instruction can neither run Lua code, through a call or
+	// a metamethod, nor change a table; errors are fine as they leave the loop
+	fn is_pure(&self, pc: usize, inst: Inst) -> bool {
+		if let Some(arith) = Arith::from_inst(inst) {
+			return match self.infer.arith_kind(pc, &arith) {
+				Kind::Integer => arith.integer.is_some(),
+				Kind::Number => arith.number.is_some(),
+				Kind::Unknown | Kind::Any => false,
+			};
+		}
+
+		match inst.opcode() {
+			Opcode::Move
+			| Opcode::LoadI
+			| Opcode::LoadF
+			| Opcode::LoadK
+			| Opcode::LoadKX
+			| Opcode::LoadFalse
+			| Opcode::LFalseSkip
+			| Opcode::LoadTrue
+			| Opcode::LoadNil
+			| Opcode::GetUpval
+			| Opcode::SetUpval
+			| Opcode::MmBin
+			| Opcode::MmBinI
+			| Opcode::MmBinK
+			| Opcode::Not
+			| Opcode::Jmp
+			| Opcode::EqK
+			| Opcode::Test
+			| Opcode::TestSet
+			| Opcode::ForPrep
+			| Opcode::ForLoop
+			| Opcode::ExtraArg => true,
+			Opcode::Unm | Opcode::Bnot => self
+				.infer
+				.operand(pc, Operand::Register(inst.b() as usize))
+				.is_unboxed(),
+			_ => self.cond_expr(pc, inst).is_some(),
+		}
+	}
+
+	pub fn write_local_list(&self, w: &mut dyn Write) -> Result<()> {
+		for (range, kind) in self.infer.local_list() {
+			let name = local_name(range, kind);
+
+			match kind {
+				Kind::Integer => write!(w, "lua_Integer {} = 0;", name),
+				_ => write!(w, "lua_Number {} = 0;", name),
+			}?;
+		}
+
+		for array in &self.array_list {
+			for &reg in &array.table_list {
+				write!(w, "Table *{} = NULL;", array.table_name(reg))?;
+			}
+
+			if array.is_pure {
+				write!(w, "int {} = 0;", array.fast_name())?;
+			}
+		}
+
+		Ok(())
+	}
+
+	pub fn infer(&self) -> &Inference {
+		&self.infer
+	}
+
+	// nothing is known about the stack when control arrives at a label
+	pub fn reset(&mut self, block: usize) {
+		for (dirty, current) in self.dirty.iter_mut().zip(self.current.iter_mut()) {
+			*dirty = None;
+			*current = None;
+		}
+
+		for (reg, range) in self.infer.entry_list(block) {
+			self.current[reg] = Some(range);
+
+			if self.kind(range).is_unboxed() {
+				self.dirty[reg] = Some(range);
+			}
+		}
+	}
+
+	// called before an instruction that works on the boxed stack
+	pub fn write_flush(&mut self, w: &mut dyn Write, pc: usize) -> Result<()> {
+		self.write_flush_except(w, pc, None)
+	}
+
+	// leaves out a register the instruction only reads from its local
+	fn write_flush_except(
+		&mut self,
+		w: &mut dyn Write,
+		pc: usize,
+		skip: Option<usize>,
+	) -> Result<()> {
+		for (reg, range) in self.infer.use_list(pc) {
+			if self.dirty[reg] == Some(range) && Some(reg) != skip {
+				let kind = self.kind(range);
+
+				self.dirty[reg] = None;
+				write!(
+					w,
+					"{}({}, {});",
+					box_name(kind),
+					reg,
+					local_name(range, kind)
+				)?;
+			}
+		}
+
+		Ok(())
+	}
+
+	// called before a call that may yield, as a resumed function only has
+	// the stack to go on; every local still needed after it is written back
+	pub fn write_spill(&mut self, w: &mut dyn Write, pc: usize, inst: Inst) -> Result<()> {
+		self.write_flush(w, pc)?;
+
+		for reg in 0..kept_below(inst) {
+			if let Some(range) = self.dirty[reg].take() {
+				let kind = self.kind(range);
+
+				write!(
+					w,
+					"{}({}, {});",
+					box_name(kind),
+					reg,
+					local_name(range, kind)
+				)?;
+			}
+		}
+
+		Ok(())
+	}
+
+	// code reloading the locals a call that may yield was spilled with,
+	// which is run when resuming after it, along with the tables of the
+	// loops it is in as C locals start over when resuming
+	pub fn reload(&self, pc: usize, inst: Inst) -> String {
+		let mut result = String::new();
+
+		for array in self
+			.array_list
+			.iter()
+			.filter(|v| v.prep < pc && pc < v.post)
+		{
+			for &reg in &array.table_list {
+				result += &format!("lua_hoist_table({}, {});", array.table_name(reg), reg);
+			}
+		}
+
+		for reg in 0..kept_below(inst) {
+			let range = match self.current[reg] {
+				Some(range) if self.kind(range).is_unboxed() => range,
+				_ => continue,
+			};
+
+			let kind = self.kind(range);
+
+			result += &format!(
+				"{} = {}({});",
+				local_name(range, kind),
+				unbox_name(kind),
+				reg
+			);
+		}
+
+		result
+	}
+
+	// called after an instruction that works on the boxed stack, as
+	// whatever it wrote is now only on the stack
+	pub fn write_done(&mut self, pc: usize) {
+		for (reg, _) in self.infer.def_list(pc) {
+			self.dirty[reg] = None;
+		}
+
+		self.define(pc);
+	}
+
+	fn define(&mut self, pc: usize) {
+		for (reg, range) in self.infer.def_list(pc) {
+			self.current[reg] = Some(range);
+		}
+	}
+
+	// tries to write an instruction over unboxed values, and returns
+	// whether it did; the caller falls back to the boxed macro otherwise
+	pub fn write(
+		&mut self,
+		w: &mut dyn Write,
+		pc: usize,
+		inst: Inst,
+		on_true: &str,
+		on_false: &str,
+	) -> Result<bool> {
+		let done = self.write_typed(w, pc, inst, on_true, on_false)?;
+
+		if done {
+			self.define(pc);
+		}
+
+		Ok(done)
+	}
+
+	fn write_typed(
+		&mut self,
+		w: &mut dyn Write,
+		pc: usize,
+		inst: Inst,
+		on_true: &str,
+		on_false: &str,
+	) -> Result<bool> {
+		let a = inst.a() as usize;
+		let b = inst.b() as usize;
+
+		if let Some(arith) = Arith::from_inst(inst) {
+			return self.write_arith(w, pc, a, &arith);
+		}
+
+		match inst.opcode() {
+			Opcode::Move => {
+				let src = self.infer.use_range(pc, b);
+				let kind = self.infer.range_kind(src);
+
+				if !kind.is_unboxed() {
+					return Ok(false);
+				}
+
+				self.write_set(w, pc, a, kind, &local_name(src.unwrap(), kind))?;
+			}
+			Opcode::LoadI | Opcode::LoadF | Opcode::LoadK => {
+				let kind = self.infer.range_kind(self.infer.def_range(pc, a));
+
+				if !kind.is_unboxed() {
+					return Ok(false);
+				}
+
+				let value = match inst.opcode() {
+					Opcode::LoadI => inst.sbx().to_string(),
+					Opcode::LoadF => format!("cast_num({})", inst.sbx()),
+					_ => self.operand(pc, Operand::Constant(inst.bx() as usize), kind),
+				};
+
+				self.write_set(w, pc, a, kind, &value)?;
+			}
+			Opcode::Unm | Opcode::Bnot => {
+				let src = self.infer.use_range(pc, b);
+				let kind = self.infer.range_kind(src);
+				let value = match (inst.opcode(), kind) {
+					(Opcode::Unm, Kind::Integer) => "intop(-, 0, {})",
+					(Opcode::Unm, Kind::Number) => "luai_numunm(L, {})",
+					(Opcode::Bnot, Kind::Integer) => "intop(^, ~l_castS2U(0), {})",
+					_ => return Ok(false),
+				};
+
+				let value = value.replace("{}", &local_name(src.unwrap(), kind));
+
+				self.write_set(w, pc, a, kind, &value)?;
+			}
+			Opcode::ForPrep => {
+				if self.infer.loop_kind(pc) != Kind::Integer {
+					return Ok(false);
+				}
+
+				self.write_flush(w, pc)?;
+
+				if let Some(array) = self.array_list.iter().find(|v| v.prep == pc) {
+					let hoist = Self::hoist(array);
+
+					write!(
+						w,
+						"op_forprep_hoisted({:#010x}, {}, {}, {}, {}, {});",
+						inst.inner,
+						self.def_local(pc, a + 1),
+						self.def_local(pc, a + 3),
+						hoist,
+						on_true,
+						on_false
+					)?;
+
+					return Ok(true);
+				}
+
+				write!(
+					w,
+					"op_forprep_unboxed({:#010x}, {}, {}, {}, {});",
+					inst.inner,
+					self.def_local(pc, a + 1),
+					self.def_local(pc, a + 3),
+					on_true,
+					on_false
+				)?;
+			}
+			Opcode::ForLoop => {
+				if self.infer.loop_kind(pc) != Kind::Integer {
+					return Ok(false);
+				}
+
+				write!(
+					w,
+					"op_forloop_unboxed({}, {}, {}, {}, {}, {});",
+					self.def_local(pc, a),
+					self.def_local(pc, a + 1),
+					self.def_local(pc, a + 2),
+					self.def_local(pc, a + 3),
+					on_true,
+					on_false
+				)?;
+			}
+			Opcode::GetTable | Opcode::SetTable if self.access_map.contains_key(&pc) => {
+				let array = &self.array_list[self.access_map[&pc]];
+				let (table, key) = Self::array_access(inst).unwrap();
+				let name = match inst.opcode() {
+					Opcode::GetTable => "op_getarray",
+					_ => "op_setarray",
+				};
+				let table = array.table_name(table);
+				let fast = array.fast_name();
+				let range = self.infer.use_range(pc, key).unwrap();
+				let key_local = local_name(range, self.kind(range));
+
+				// the value stored may be the key itself, which is then read boxed
+				let is_value =
+					inst.opcode() == Opcode::SetTable && !inst.k() && inst.c() as usize == key;
+				let skip = Some(key).filter(|_| !is_value);
+
+				self.write_flush_except(w, pc, skip)?;
+
+				write!(
+					w,
+					"{}({:#010x}, {}, {}, {});",
+					name, inst.inner, table, fast, key_local
+				)?;
+
+				for (reg, _) in self.infer.def_list(pc) {
+					self.dirty[reg] = None;
+				}
+			}
+			_ => {
+				let cond = match self.cond_expr(pc, inst) {
+					Some(cond) => cond,
+					None => return Ok(false),
+				};
+
+				write!(
+					w,
+					"op_cond_unboxed({:#010x}, {}, {}, {});",
+					inst.inner, cond, on_true, on_false
+				)?;
+			}
+		}
+
+		Ok(true)
+	}
+
+	// takes the tables of a loop out of their registers and, if nothing in
+	// the loop can change them, checks whether every access is in range
+	fn hoist(array: &ArrayLoop) -> String {
+		let mut result = String::new();
+
+		for &reg in &array.table_list {
+			result += &format!("lua_hoist_table({}, {});", array.table_name(reg), reg);
+		}
+
+		if array.is_pure {
+			let cover_list: Vec<_> = array
+				.table_list
+				.iter()
+				.map(|&v| format!("lua_covers_range({}, lo, hi)", array.table_name(v)))
+				.collect();
+
+			result += &format!("{} = {};", array.fast_name(), cover_list.join(" && "));
+		}
+
+		result
+	}
+
+	fn kind(&self, range: usize) -> Kind {
+		self.infer.range_kind(Some(range))
+	}
+
+	fn def_local(&self, pc: usize, reg: usize) -> String {
+		let range = self
+			.infer
+			.def_range(pc, reg)
+			.expect("register is not written");
+
+		local_name(range, self.kind(range))
+	}
+
+	// results either go to the live range's local, or straight to the
+	// stack slot when the live range also holds other types elsewhere
+	fn write_set(
+		&mut self,
+		w: &mut dyn Write,
+		pc: usize,
+		reg: usize,
+		kind: Kind,
+		value: &str,
+	) -> Result<()> {
+		let range = self
+			.infer
+			.def_range(pc, reg)
+			.expect("register is not written");
+
+		if self.kind(range) == kind {
+			self.dirty[reg] = Some(range);
+			write!(w, "{} = {};", local_name(range, kind), value)
+		} else {
+			self.dirty[reg] = None;
+			write!(w, "{}({}, {});", box_name(kind), reg, value)
+		}
+	}
+
+	fn write_arith(
+		&mut self,
+		w: &mut dyn Write,
+		pc: usize,
+		a: usize,
+		arith: &Arith,
+	) -> Result<bool> {
+		let kind = self.infer.arith_kind(pc, arith);
+		let func = match kind {
+			Kind::Integer => arith.integer,
+			Kind::Number => arith.number,
+			Kind::Unknown | Kind::Any => None,
+		};
+
+		let func = match func {
+			Some(func) => func,
+			None => return Ok(false),
+		};
+
+		let lhs = self.operand(pc, arith.lhs, kind);
+		let rhs = self.operand(pc, arith.rhs, kind);
+		let value = if arith.is_bitwise() {
+			format!("{}({}, {})", func, lhs, rhs)
+		} else {
+			format!("{}(L, {}, {})", func, lhs, rhs)
+		};
+
+		self.write_set(w, pc, a, kind, &value)?;
+
+		Ok(true)
+	}
+
+	// reads an operand as `want`, promoting integers where needed
+	fn operand(&self, pc: usize, op: Operand, want: Kind) -> String {
+		let kind = self.infer.operand(pc, op);
+		let value = match op {
+			Operand::Register(reg) => {
+				let range = self.infer.use_range(pc, reg).expect("register is not live");
+
+				local_name(range, kind)
+			}
+			Operand::Constant(index) => self.literal_list[index].clone(),
+			Operand::Immediate(imm) => imm.to_string(),
+		};
+
+		if kind == want {
+			value
+		} else {
+			format!("cast_num({})", value)
+		}
+	}
+
+	fn cond_expr(&self, pc: usize, inst: Inst) -> Option<String> {
+		let lhs = Operand::Register(inst.a() as usize);
+		let kind = self.infer.operand(pc, lhs);
+
+		if !kind.is_unboxed() {
+			return None;
+		}
+
+		let imm = Operand::Immediate(inst.sb());
+		let (int_op, num_op, rhs) = match inst.opcode() {
+			Opcode::Eq => ("l_eqi", "luai_numeq", Operand::Register(inst.b() as usize)),
+			Opcode::Lt => ("l_lti", "luai_numlt", Operand::Register(inst.b() as usize)),
+			Opcode::Le => ("l_lei", "luai_numle", Operand::Register(inst.b() as usize)),
+			Opcode::EqK => ("l_eqi", "luai_numeq", Operand::Constant(inst.b() as usize)),
+			Opcode::EqI => ("l_eqi", "luai_numeq", imm),
+			Opcode::LtI => ("l_lti", "luai_numlt", imm),
+			Opcode::LeI => ("l_lei", "luai_numle", imm),
+			Opcode::GtI => ("l_gti", "luai_numgt", imm),
+			Opcode::GeI => ("l_gei", "luai_numge", imm),
+			_ => return None,
+		};
+
+		// registers and constants must match exactly, while immediates
+		// can be promoted the same way the interpreter does
+		match rhs {
+			Operand::Immediate(_) => {}
+			_ if self.infer.operand(pc, rhs) == kind => {}
+			_ => return None,
+		}
+
+		let func = if kind == Kind::Integer {
+			int_op
+		} else {
+			num_op
+		};
+		let lhs = self.operand(pc, lhs, kind);
+		let rhs = self.operand(pc, rhs, kind);
+
+		Some(format!("{}({}, {})", func, lhs, rhs))
+	}
+}
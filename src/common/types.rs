@@ -29,8 +29,14 @@ impl Inst {
 		self.inner.get_bit(15)
 	}
 
+	ext_operand!(a, u32, 7..15);
+	ext_operand!(b, u32, 16..24);
+	ext_operand!(c, u32, 24..32);
 	ext_operand!(ax, u32, 7..32);
 	ext_operand!(bx, u32, 15..32);
+	ext_s_operand!(sb, i32, 16..24);
+	ext_s_operand!(sc, i32, 24..32);
+	ext_s_operand!(sbx, i32, 15..32);
 	ext_s_operand!(sj, i32, 7..32);
 }
 
@@ -180,25 +186,26 @@ pub struct AbsLine {
 	pub line: u32,
 }
 
+// strings borrow from the bytecode they were loaded from, as
+// Lua strings are not required to be valid UTF-8
 #[derive(Clone)]
-pub enum Value {
+pub enum Value<'a> {
 	Nil,
 	False,
 	True,
 	Integer(Integer),
 	Number(Number),
 	NoString,
-	String(String),
+	String(&'a [u8]),
 }
 
-pub struct Local {
-	pub name: Option<String>,
+pub struct Local<'a> {
+	pub name: Option<&'a [u8]>,
 	pub start_pc: u32,
 	pub end_pc: u32,
 }
 
 pub struct Upvalue {
-	pub name: Option<String>,
 	pub in_stack: bool,
 	pub index: u8,
 }
@@ -211,20 +218,53 @@ pub enum Target {
 pub struct Block {
 	pub code: Vec<Inst>,
 	pub target: Target,
+	pub next: Option<u32>,
+	pub pred_list: Vec<u32>,
 }
 
-pub struct Proto {
-	pub source: Option<String>,
+// the optional parts of a function, decoded on demand by `load_debug_info`
+pub struct DebugInfo<'a> {
+	pub rel_line_list: Vec<i8>,
+	pub abs_line_list: Vec<AbsLine>,
+	pub local_list: Vec<Local<'a>>,
+}
+
+// a `rel_line_list` entry meaning the line is in `abs_line_list` instead
+const ABS_LINE_INFO: i8 = -0x80;
+
+impl DebugInfo<'_> {
+	// the line of every instruction, as `luaG_getfuncline` finds them,
+	// which is 0 where the function has been stripped
+	pub fn line_list(&self, line_defined: u32) -> Vec<u32> {
+		let mut abs_iter = self.abs_line_list.iter();
+		let mut line = i64::from(line_defined);
+
+		self.rel_line_list
+			.iter()
+			.enumerate()
+			.map(|(pc, &rel)| {
+				if rel != ABS_LINE_INFO {
+					line += i64::from(rel);
+				} else if let Some(abs) = abs_iter.find(|v| v.pc as usize == pc) {
+					line = i64::from(abs.line);
+				}
+
+				line as u32
+			})
+			.collect()
+	}
+}
+
+pub struct Proto<'a> {
+	pub source: Option<&'a [u8]>,
 	pub is_vararg: u8,
 	pub num_stack: u8,
 	pub num_param: u8,
 	pub line_defined: u32,
 	pub last_line_defined: u32,
-	pub value_list: Vec<Value>,
+	pub value_list: Vec<Value<'a>>,
 	pub block_list: Vec<Block>,
-	pub child_list: Vec<Proto>,
+	pub child_list: Vec<Proto<'a>>,
 	pub upval_list: Vec<Upvalue>,
-	pub rel_line_list: Vec<i8>,
-	pub abs_line_list: Vec<AbsLine>,
-	pub local_list: Vec<Local>,
+	pub debug_info: &'a [u8],
 }
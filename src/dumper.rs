@@ -39,9 +39,9 @@ where
 	dump_unsigned(val.into(), w)
 }
 
-fn dump_string(val: &str, w: &mut dyn Write) -> Result<()> {
+fn dump_string(val: &[u8], w: &mut dyn Write) -> Result<()> {
 	dump_integer(val.len() as u64 + 1, w)?;
-	w.write_all(val.as_bytes())
+	w.write_all(val)
 }
 
 fn dump_list<T, M>(list: &[T], dump: M, w: &mut dyn Write) -> Result<()>
@@ -74,7 +74,17 @@ fn dump_constant(value: &Value, w: &mut dyn Write) -> Result<()> {
 
 			dump_string(s, w)
 		}
-		_ => u8::from(Constant::Nil).ser(w),
+		Value::Integer(i) => {
+			u8::from(Constant::Integer).ser(w)?;
+			i.ser(w)
+		}
+		Value::Number(n) => {
+			u8::from(Constant::Number).ser(w)?;
+			n.ser(w)
+		}
+		Value::False => u8::from(Constant::False).ser(w),
+		Value::True => u8::from(Constant::True).ser(w),
+		Value::Nil => u8::from(Constant::Nil).ser(w),
 	}
 }
 
@@ -2,8 +2,8 @@ use crate::{
 	common::{
 		number::{load_unsigned, Serde},
 		types::{
-			AbsLine, Constant, Inst, Instruction, Integer, Local, Number, Proto, Res, Upvalue,
-			Value, LUA_DATA, LUA_INT, LUA_MAGIC, LUA_NUM,
+			AbsLine, Constant, DebugInfo, Inst, Instruction, Integer, Local, Number, Proto, Res,
+			Upvalue, Value, LUA_DATA, LUA_INT, LUA_MAGIC, LUA_NUM,
 		},
 	},
 	splitter::Splitter,
@@ -39,7 +39,7 @@ where
 	map_res(load_unsigned, T::try_from)(input)
 }
 
-fn load_string_opt(input: &[u8]) -> Res<Option<String>> {
+fn load_string_opt(input: &[u8]) -> Res<Option<&[u8]>> {
 	let (input, len) = load_t::<u32>(input)?;
 
 	if len == 0 {
@@ -47,9 +47,8 @@ fn load_string_opt(input: &[u8]) -> Res<Option<String>> {
 	}
 
 	let (input, inner) = take(len - 1)(input)?;
-	let value = String::from_utf8_lossy(inner).to_string();
 
-	Ok((input, Some(value)))
+	Ok((input, Some(inner)))
 }
 
 fn load_string(input: &[u8]) -> Res<Value> {
@@ -59,13 +58,29 @@ fn load_string(input: &[u8]) -> Res<Value> {
 	})(input)
 }
 
-fn load_list<T, F>(func: F) -> impl Fn(&[u8]) -> Res<Vec<T>>
+fn load_list<'a, T, F>(func: F) -> impl Fn(&'a [u8]) -> Res<'a, Vec<T>>
 where
-	F: Fn(&[u8]) -> Res<T> + Copy,
+	F: Fn(&'a [u8]) -> Res<'a, T> + Copy,
 {
 	move |input| length_count(load_t::<u32>, func)(input)
 }
 
+// walks a list without keeping any of its items
+fn skip_list<'a, T, F>(func: F) -> impl Fn(&'a [u8]) -> Res<'a, ()>
+where
+	F: Fn(&'a [u8]) -> Res<'a, T>,
+{
+	move |input| {
+		let (mut input, len) = load_t::<u32>(input)?;
+
+		for _ in 0..len {
+			input = func(input)?.0;
+		}
+
+		Ok((input, ()))
+	}
+}
+
 fn load_instruction(input: &[u8]) -> Res<Inst> {
 	map(Instruction::deser, |inner| Inst { inner })(input)
 }
@@ -89,7 +104,6 @@ fn load_upvalue(input: &[u8]) -> Res<Upvalue> {
 	let (input, index) = u8(input)?;
 	let (input, _) = u8(input)?; // kind is unused
 	let result = Upvalue {
-		name: None,
 		in_stack: in_stack != 0,
 		index,
 	};
@@ -118,6 +132,36 @@ fn load_local(input: &[u8]) -> Res<Local> {
 	Ok((input, result))
 }
 
+// checks the debug lists are well formed and returns their raw bytes,
+// leaving the decoding to `load_debug_info` for whatever needs them
+fn skip_debug_info(input: &[u8]) -> Res<&[u8]> {
+	let (rest, _) = skip_list(i8::deser)(input)?;
+	let (rest, _) = skip_list(load_abs_line_info)(rest)?;
+	let (rest, _) = skip_list(load_local)(rest)?;
+	let (rest, _) = skip_list(load_string_opt)(rest)?;
+	let data = &input[..input.len() - rest.len()];
+
+	Ok((rest, data))
+}
+
+pub fn load_debug_info(data: &[u8]) -> DebugInfo {
+	let load = |input| -> Res<DebugInfo> {
+		let (input, rel_line_list) = load_list(i8::deser)(input)?;
+		let (input, abs_line_list) = load_list(load_abs_line_info)(input)?;
+		let (input, local_list) = load_list(load_local)(input)?;
+		let (input, _) = skip_list(load_string_opt)(input)?;
+		let result = DebugInfo {
+			rel_line_list,
+			abs_line_list,
+			local_list,
+		};
+
+		Ok((input, result))
+	};
+
+	load(data).expect("debug info was checked on load").1
+}
+
 fn load_function(input: &[u8]) -> Res<Proto> {
 	let (input, source) = load_string_opt(input)?;
 	let (input, line_defined) = load_t::<u32>(input)?;
@@ -131,21 +175,13 @@ fn load_function(input: &[u8]) -> Res<Proto> {
 	// essential
 	let (input, inst_list) = load_list(load_instruction)(input)?;
 	let (input, value_list) = load_list(load_constant)(input)?;
-	let (input, mut upval_list) = load_list(load_upvalue)(input)?;
+	let (input, upval_list) = load_list(load_upvalue)(input)?;
 	let (input, child_list) = load_list(load_function)(input)?;
 
 	// debug
-	let (input, rel_line_list) = load_list(i8::deser)(input)?;
-	let (input, abs_line_list) = load_list(load_abs_line_info)(input)?;
-	let (input, local_list) = load_list(load_local)(input)?;
-	let (input, name_list) = load_list(load_string_opt)(input)?;
+	let (input, debug_info) = skip_debug_info(input)?;
 
 	let block_list = Splitter::new().split(inst_list);
-
-	for (upv, name) in upval_list.iter_mut().zip(name_list) {
-		upv.name = name;
-	}
-
 	let result = Proto {
 		source,
 		is_vararg,
@@ -157,9 +193,7 @@ fn load_function(input: &[u8]) -> Res<Proto> {
 		block_list,
 		child_list,
 		upval_list,
-		rel_line_list,
-		abs_line_list,
-		local_list,
+		debug_info,
 	};
 
 	Ok((input, result))
@@ -1,6 +1,16 @@
-use codegen::gen::transpile;
+use codegen::{
+	cache::Cache,
+	gen::{transpile, transpile_dir, Module, OptLevel, Settings},
+	profile::Profile,
+};
+use common::types::Proto;
 use loader::load_lua_module;
-use std::io::Result;
+use memmap2::Mmap;
+use std::{
+	fs::File,
+	io::Result,
+	path::{Path, PathBuf},
+};
 
 mod codegen;
 mod common;
@@ -8,35 +18,175 @@ mod dumper;
 mod loader;
 mod splitter;
 
+// settings that apply to every file transpiled after them
+struct Options {
+	num_worker: usize,
+	num_shard: Option<usize>,
+	output: Option<PathBuf>,
+	module_list: Vec<(String, PathBuf)>,
+	static_proto: bool,
+	profile: bool,
+	feedback: Option<PathBuf>,
+	debug: bool,
+	opt_level: OptLevel,
+	cache: Option<PathBuf>,
+}
+
 fn list_help() {
 	println!("usage: lean [options]");
+	println!("  -g | --debug             write `#line` directives and readable function names");
 	println!("  -h | --help              show the help message");
+	println!("  -j | --jobs [count]      set the number of code generation workers");
+	println!("  -m | --module [name] [file]");
+	println!("                           bundle a bytecode file to be found by `require`");
+	println!("  -o | --output [dir]      write sharded C files and a makefile fragment");
+	println!("  -O | --opt-level [level]");
+	println!("                           favour size with 0 up to speed with 2, the default");
+	println!("  -s | --shards [count]    set the number of shards, defaults to the jobs");
+	println!("  --profile                count blocks and report the hot lines at exit");
+	println!("  --use-profile [file]     guide code generation by a `--profile` report");
+	println!("  --cache [dir]            reuse the C of functions unchanged since a past run");
+	println!("  --static-proto           build prototypes from static data, not a glue chunk");
 	println!("  -t | --transpile [file]  transpile a bytecode file to C");
 }
 
-fn transpile_data(data: &[u8]) {
+// the prototypes borrow their strings from the mapping, so
+// the file must not be changed while it is being transpiled
+fn map_file(name: &Path) -> Result<Mmap> {
+	let file = File::open(name)?;
+
+	unsafe { Mmap::map(&file) }
+}
+
+fn load_data(data: &[u8]) -> Proto {
 	let (trail, proto) = load_lua_module(data).expect("not valid Lua 5.4 bytecode");
 
 	if !trail.is_empty() {
 		panic!("trailing garbage in Lua file");
 	}
 
-	transpile(&mut std::io::stdout().lock(), &proto).unwrap();
+	proto
+}
+
+fn transpile_data(data: &[u8], mapped_list: &[(&str, Mmap)], options: &Options) -> Result<()> {
+	let proto = load_data(data);
+	let module_list: Vec<_> = mapped_list
+		.iter()
+		.map(|(name, data)| Module {
+			name,
+			proto: load_data(data),
+		})
+		.collect();
+
+	let feedback = match &options.feedback {
+		Some(name) => Some(Profile::parse(&std::fs::read_to_string(name)?)),
+		None => None,
+	};
+	let cache = match &options.cache {
+		Some(dir) => Some(Cache::new(dir)?),
+		None => None,
+	};
+	let settings = Settings {
+		num_worker: options.num_worker,
+		num_shard: options.num_shard.unwrap_or(options.num_worker),
+		static_proto: options.static_proto,
+		profile: options.profile,
+		feedback,
+		debug: options.debug,
+		opt_level: options.opt_level,
+		cache,
+	};
+
+	match &options.output {
+		Some(dir) => transpile_dir(dir, &proto, &module_list, &settings),
+		None => {
+			let w = &mut std::io::stdout().lock();
+
+			transpile(w, &proto, &module_list, &settings)
+		}
+	}
+}
+
+fn parse_count(value: Option<String>) -> usize {
+	let value = value.expect("count expected");
+
+	value.parse().expect("count is not a number")
 }
 
 fn main() -> Result<()> {
 	let mut iter = std::env::args().skip(1);
+	let mut options = Options {
+		num_worker: std::thread::available_parallelism().map_or(1, |v| v.get()),
+		num_shard: None,
+		output: None,
+		module_list: Vec::new(),
+		static_proto: false,
+		profile: false,
+		feedback: None,
+		debug: false,
+		opt_level: OptLevel::Speed,
+		cache: None,
+	};
 
 	while let Some(val) = iter.next() {
 		match val.as_str() {
+			"-g" | "--debug" => {
+				options.debug = true;
+			}
 			"-h" | "--help" => {
 				list_help();
 			}
+			"-j" | "--jobs" => {
+				options.num_worker = parse_count(iter.next());
+			}
+			"-m" | "--module" => {
+				let name = iter.next().expect("module name expected");
+				let file = iter.next().expect("file name expected");
+
+				options.module_list.push((name, file.into()));
+			}
+			"-o" | "--output" => {
+				let name = iter.next().expect("directory name expected");
+
+				options.output = Some(name.into());
+			}
+			"-O" | "--opt-level" => {
+				options.opt_level = match parse_count(iter.next()) {
+					0 => OptLevel::Size,
+					1 => OptLevel::Balanced,
+					2 => OptLevel::Speed,
+					_ => panic!("level is not 0, 1 or 2"),
+				};
+			}
+			"-s" | "--shards" => {
+				options.num_shard = Some(parse_count(iter.next()));
+			}
+			"--profile" => {
+				options.profile = true;
+			}
+			"--use-profile" => {
+				let name = iter.next().expect("file name expected");
+
+				options.feedback = Some(name.into());
+			}
+			"--cache" => {
+				let name = iter.next().expect("directory name expected");
+
+				options.cache = Some(name.into());
+			}
+			"--static-proto" => {
+				options.static_proto = true;
+			}
 			"-t" | "--transpile" => {
 				let name = iter.next().expect("file name expected");
-				let data = std::fs::read(name)?;
+				let data = map_file(name.as_ref())?;
+				let mapped_list = options
+					.module_list
+					.iter()
+					.map(|(name, file)| Ok((name.as_str(), map_file(file)?)))
+					.collect::<Result<Vec<_>>>()?;
 
-				transpile_data(&data);
+				transpile_data(&data, &mapped_list, &options)?;
 			}
 			opt => {
 				panic!("unknown option `{}`", opt);
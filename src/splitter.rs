@@ -1,113 +1,411 @@
 use crate::common::types::{Block, Inst, Opcode, Target};
-use std::collections::{BTreeSet, HashMap};
 
-// breaks a stream of instructions into basic blocks
-// `label_set` contains a set of where a jump starts or ends
-// `target_map` contains a set of where a jump targets and its offset
+// the offset an instruction may jump by, relative to the one after it
+fn jump_offset(inst: Inst) -> Option<i32> {
+	let offset = match inst.opcode() {
+		Opcode::LFalseSkip
+		| Opcode::Test
+		| Opcode::TestSet
+		| Opcode::Eq
+		| Opcode::Lt
+		| Opcode::Le
+		| Opcode::EqK
+		| Opcode::EqI
+		| Opcode::LtI
+		| Opcode::LeI
+		| Opcode::GtI
+		| Opcode::GeI => 1,
+		Opcode::Jmp => inst.sj(),
+		Opcode::ForPrep => inst.bx() as i32 + 1,
+		Opcode::TForPrep => inst.bx() as i32,
+		Opcode::ForLoop | Opcode::TForLoop => -(inst.bx() as i32),
+		_ => return None,
+	};
+
+	Some(offset)
+}
+
+// whether control can go on to the next instruction
+fn falls_through(inst: Inst) -> bool {
+	!matches!(
+		inst.opcode(),
+		Opcode::Return
+			| Opcode::Return0
+			| Opcode::Return1
+			| Opcode::Jmp
+			| Opcode::LFalseSkip
+			| Opcode::TForPrep
+	)
+}
+
+fn is_lone_jump(blk: &Block) -> bool {
+	matches!(blk.code.as_slice(), [inst] if inst.opcode() == Opcode::Jmp)
+}
+
+impl Block {
+	// whether the block ends in an instruction that can jump to `target`
+	pub fn is_branch(&self) -> bool {
+		self.code.last().and_then(|&v| jump_offset(v)).is_some()
+	}
+
+	// the blocks control can flow to after the end of this one
+	pub fn successor_list(&self) -> Vec<usize> {
+		let target = match self.target {
+			Target::Label(label) if self.is_branch() => Some(label as usize),
+			_ => None,
+		};
+
+		target
+			.into_iter()
+			.chain(self.next.map(|v| v as usize))
+			.collect()
+	}
+}
+
+// breaks a stream of instructions into a control flow graph of basic blocks
+// `label_list` marks every instruction a block starts at
+// `block_of` is the dense index of the block each instruction is in
 pub struct Splitter {
-	label_set: BTreeSet<usize>,
-	target_map: HashMap<usize, i32>,
+	label_list: Vec<bool>,
+	block_of: Vec<u32>,
 }
 
 impl Splitter {
 	// after start/end positions are decided, we just split the original
-	// code based on those indices and add a bit of useful information
-	// like the next label we jump to, or an undefined offset if the jump
-	// is not well formed
+	// code based on those indices and link the blocks together; then
+	// jumps to jumps are threaded through and blocks that can only be
+	// entered from the one before them are merged into it
 	pub fn new() -> Self {
 		Self {
-			label_set: BTreeSet::new(),
-			target_map: HashMap::new(),
+			label_list: Vec::new(),
+			block_of: Vec::new(),
 		}
 	}
 
 	pub fn split(mut self, code: Vec<Inst>) -> Vec<Block> {
 		self.find_edges(&code);
-		self.split_at_edges(code)
-	}
 
-	fn add_target(&mut self, pc: usize, offset: i32) {
-		let dest = pc as i32 + offset + 1;
+		let mut block_list = self.split_at_edges(code);
+
+		thread_jumps(&mut block_list);
+
+		let mut block_list = merge_blocks(block_list);
 
-		self.label_set.insert(dest as usize);
-		self.target_map.insert(pc, offset);
+		find_predecessors(&mut block_list);
+
+		block_list
 	}
 
 	fn find_edges(&mut self, code: &[Inst]) {
-		self.label_set.insert(0);
-
-		for (pc, inst) in code.iter().enumerate() {
-			match inst.opcode() {
-				Opcode::LFalseSkip
-				| Opcode::Test
-				| Opcode::TestSet
-				| Opcode::Eq
-				| Opcode::Lt
-				| Opcode::Le
-				| Opcode::EqK
-				| Opcode::EqI
-				| Opcode::LtI
-				| Opcode::LeI
-				| Opcode::GtI
-				| Opcode::GeI => {
-					self.add_target(pc, 1);
-				}
-				Opcode::Jmp => {
-					self.add_target(pc, inst.sj());
-				}
-				Opcode::ForPrep => {
-					self.add_target(pc, inst.bx() as i32 + 1);
-				}
-				Opcode::TForPrep => {
-					self.add_target(pc, inst.bx() as i32);
-				}
-				Opcode::ForLoop | Opcode::TForLoop => {
-					let sbx = inst.bx() as i32;
+		self.label_list = vec![false; code.len() + 1];
+		self.label_list[0] = true;
 
-					self.add_target(pc, -sbx);
-				}
-				Opcode::Return | Opcode::Return0 | Opcode::Return1 => {}
-				_ => {
-					continue;
+		for (pc, &inst) in code.iter().enumerate() {
+			if let Some(offset) = jump_offset(inst) {
+				let dest = pc as i64 + i64::from(offset) + 1;
+
+				if let Some(v) = self.label_list.get_mut(dest as usize).filter(|_| dest >= 0) {
+					*v = true;
 				}
+			} else if falls_through(inst) {
+				continue;
 			}
 
-			self.label_set.insert(pc + 1);
+			self.label_list[pc + 1] = true;
 		}
 
-		self.label_set.retain(|&v| v <= code.len());
+		let mut index = 0;
+
+		self.block_of = Vec::with_capacity(code.len());
+
+		for pc in 0..code.len() {
+			if pc != 0 && self.label_list[pc] {
+				index += 1;
+			}
+
+			self.block_of.push(index);
+		}
 	}
 
+	// an out of bounds destination means the jump was either
+	// past the last instruction or before the first one
 	fn get_offset_target(&self, post: usize, offset: i32) -> Target {
-		// nasty; we count the index of the label before our destination
-		let dest = post as i32 + offset;
-		let index = self.label_set.range(0..=dest as usize).count();
+		let dest = post as i64 + i64::from(offset);
 
-		// an out of bounds destination means the jump was either
-		// past the last instruction or before the first one
-		if index > self.label_set.len() {
+		if dest < 0 || dest as usize >= self.block_of.len() {
 			Target::Undefined(offset)
 		} else {
-			Target::Label(index as u32 - 1)
+			Target::Label(self.block_of[dest as usize])
 		}
 	}
 
 	fn split_at_edges(&self, code: Vec<Inst>) -> Vec<Block> {
+		let len = code.len();
 		let mut iter = code.into_iter();
 		let mut list = Vec::new();
 		let mut prev = 0;
 
-		for pc in self.label_set.iter().skip(1).map(|v| v - 1) {
-			let offset = self.target_map.get(&pc).copied().unwrap_or_default();
-			let post = pc + 1;
-
-			let code = iter.by_ref().take(post - prev).collect();
+		for post in (1..=len).filter(|&v| self.label_list[v]) {
+			let code: Vec<Inst> = iter.by_ref().take(post - prev).collect();
+			let last = *code.last().unwrap();
+			let offset = jump_offset(last).unwrap_or_default();
 			let target = self.get_offset_target(post, offset);
+			let next = Some(post)
+				.filter(|&v| v < len && falls_through(last))
+				.map(|v| self.block_of[v]);
 
 			prev = post;
-			list.push(Block { code, target });
+			list.push(Block {
+				code,
+				target,
+				next,
+				pred_list: Vec::new(),
+			});
 		}
 
 		list
 	}
 }
+
+// points every edge leading to a block that only jumps somewhere else
+// straight at where that jump goes, with each chain only walked once
+fn thread_jumps(block_list: &mut [Block]) {
+	let mut dest_list: Vec<Option<u32>> = vec![None; block_list.len()];
+	let mut on_path = vec![false; block_list.len()];
+	let mut path = Vec::new();
+
+	for start in 0..block_list.len() {
+		let mut label = start;
+
+		// chains of jumps that loop back on themselves end where they
+		// are first seen again
+		let dest = loop {
+			if let Some(dest) = dest_list[label] {
+				break dest;
+			}
+
+			match block_list[label].target {
+				Target::Label(next) if is_lone_jump(&block_list[label]) => {
+					if on_path[label] {
+						break label as u32;
+					}
+
+					on_path[label] = true;
+					path.push(label);
+					label = next as usize;
+				}
+				_ => break label as u32,
+			}
+		};
+
+		for v in path.drain(..) {
+			on_path[v] = false;
+			dest_list[v] = Some(dest);
+		}
+
+		dest_list[start] = Some(dest);
+	}
+
+	let resolve = |label: u32| dest_list[label as usize].unwrap();
+
+	for blk in block_list.iter_mut() {
+		if let Target::Label(label) = blk.target {
+			if blk.is_branch() {
+				blk.target = Target::Label(resolve(label));
+			}
+		}
+
+		blk.next = blk.next.map(resolve);
+	}
+}
+
+// joins each block into the one before it when that is its only way in,
+// and control can only go from that block to it
+fn merge_blocks(block_list: Vec<Block>) -> Vec<Block> {
+	let mut pred_count = vec![0_usize; block_list.len()];
+
+	for blk in &block_list {
+		for succ in blk.successor_list() {
+			pred_count[succ] += 1;
+		}
+	}
+
+	let mut new_index = Vec::with_capacity(block_list.len());
+	let mut list: Vec<Block> = Vec::new();
+
+	for (i, blk) in block_list.into_iter().enumerate() {
+		let joins = match list.last() {
+			Some(prev) => !prev.is_branch() && prev.next == Some(i as u32) && pred_count[i] == 1,
+			None => false,
+		};
+
+		if joins {
+			let prev = list.last_mut().unwrap();
+
+			prev.code.extend(blk.code);
+			prev.target = blk.target;
+			prev.next = blk.next;
+		} else {
+			list.push(blk);
+		}
+
+		new_index.push(list.len() as u32 - 1);
+	}
+
+	for blk in &mut list {
+		if let Target::Label(label) = blk.target {
+			blk.target = Target::Label(new_index[label as usize]);
+		}
+
+		blk.next = blk.next.map(|v| new_index[v as usize]);
+	}
+
+	list
+}
+
+fn find_predecessors(block_list: &mut [Block]) {
+	for i in 0..block_list.len() {
+		for succ in block_list[i].successor_list() {
+			block_list[succ].pred_list.push(i as u32);
+		}
+	}
+}
+
+// the blocks reachable from the entry in reverse postorder
+pub fn reverse_postorder(block_list: &[Block]) -> Vec<usize> {
+	let mut visited = vec![false; block_list.len()];
+	let mut order = Vec::with_capacity(block_list.len());
+	let mut stack = Vec::new();
+
+	if block_list.is_empty() {
+		return order;
+	}
+
+	visited[0] = true;
+	stack.push((0, block_list[0].successor_list(), 0));
+
+	while let Some((label, succ_list, index)) = stack.last_mut() {
+		match succ_list.get(*index).copied() {
+			Some(succ) => {
+				*index += 1;
+
+				if !visited[succ] {
+					visited[succ] = true;
+					stack.push((succ, block_list[succ].successor_list(), 0));
+				}
+			}
+			None => {
+				order.push(*label);
+				stack.pop();
+			}
+		}
+	}
+
+	order.reverse();
+	order
+}
+
+// the immediate dominator of every block, where the entry dominates itself
+// and unreachable blocks have none, using the Cooper, Harvey and Kennedy
+// iteration over the reverse postorder
+pub fn dominator_list(block_list: &[Block], order: &[usize]) -> Vec<Option<usize>> {
+	let mut rank = vec![usize::MAX; block_list.len()];
+	let mut idom = vec![None; block_list.len()];
+
+	for (i, &label) in order.iter().enumerate() {
+		rank[label] = i;
+	}
+
+	let intersect = |idom: &[Option<usize>], mut a: usize, mut b: usize| {
+		while a != b {
+			while rank[a] > rank[b] {
+				a = idom[a].unwrap();
+			}
+
+			while rank[b] > rank[a] {
+				b = idom[b].unwrap();
+			}
+		}
+
+		a
+	};
+
+	if let Some(&entry) = order.first() {
+		idom[entry] = Some(entry);
+	}
+
+	let mut changed = true;
+
+	while changed {
+		changed = false;
+
+		for &label in order.iter().skip(1) {
+			let mut new_idom = None;
+
+			for pred in block_list[label].pred_list.iter().map(|&v| v as usize) {
+				if idom[pred].is_none() {
+					continue;
+				}
+
+				new_idom = match new_idom {
+					Some(other) => Some(intersect(&idom, pred, other)),
+					None => Some(pred),
+				};
+			}
+
+			if new_idom != idom[label] {
+				idom[label] = new_idom;
+				changed = true;
+			}
+		}
+	}
+
+	idom
+}
+
+// how many loops every block is in, where the loop of a header is every
+// block that reaches one of its back edges without going through it
+pub fn loop_depth_list(block_list: &[Block], idom: &[Option<usize>]) -> Vec<usize> {
+	let dominates = |a: usize, mut b: usize| loop {
+		if a == b {
+			return true;
+		}
+
+		match idom[b] {
+			Some(next) if next != b => b = next,
+			_ => return false,
+		}
+	};
+
+	let mut depth = vec![0; block_list.len()];
+
+	for (head, blk) in block_list.iter().enumerate() {
+		let mut stack: Vec<usize> = blk
+			.pred_list
+			.iter()
+			.map(|&v| v as usize)
+			.filter(|&v| dominates(head, v))
+			.collect();
+
+		if stack.is_empty() {
+			continue;
+		}
+
+		let mut body = vec![false; block_list.len()];
+
+		body[head] = true;
+
+		while let Some(label) = stack.pop() {
+			if !body[label] {
+				body[label] = true;
+				stack.extend(block_list[label].pred_list.iter().map(|&v| v as usize));
+			}
+		}
+
+		for (v, _) in depth.iter_mut().zip(body).filter(|v| v.1) {
+			*v += 1;
+		}
+	}
+
+	depth
+}